@@ -0,0 +1,303 @@
+#include "ContentStore.h"
+#include "VirtualFileSystem.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+ContentStore::ContentStore(const std::string& backingPath)
+    : backingPath(backingPath), backingEnd(0), holds(0), stats() {
+}
+
+ContentStore::~ContentStore() {
+    //nodes outliving the store must not call back into it
+    for (auto& kv : entries)
+        const_cast<VFSNode*>(kv.first)->store = nullptr;
+
+    if (backing.is_open()) {
+        backing.close();
+        std::remove(backingPath.c_str());
+    }
+}
+
+ContentStore::Entry& ContentStore::track(const VFSNode* node) {
+    auto it = entries.find(node);
+    if (it != entries.end()) {
+        lru.splice(lru.begin(), it->second.spilled ? spilledList : lru, it->second.lruPos);
+        return it->second;
+    }
+
+    lru.push_front(node);
+    const_cast<VFSNode*>(node)->store = this;
+    Entry& e = entries[node];
+    e.lruPos = lru.begin();
+    e.charged = 0;
+    e.spilled = false;
+    e.offset = 0;
+    e.length = 0;
+    return e;
+}
+
+void ContentStore::recharge(const VFSNode* node, Entry& e) {
+    size_t now = e.spilled ? 0 : node->content.size();
+    stats.residentBytes = stats.residentBytes - e.charged + now;
+    e.charged = now;
+}
+
+void ContentStore::enforceBudget(const VFSNode* keep) {
+    if (stats.budget == 0 || holds > 0)
+        return;
+
+    //the body in use is never evicted; if it alone is over budget there
+    //is nothing to do
+    size_t pinned = 0;
+    auto kept = keep ? entries.find(keep) : entries.end();
+    if (kept != entries.end())
+        pinned = kept->second.charged;
+
+    //walk from the cold end. only resident bodies are in the list, and it
+    //stops as soon as nothing but the pinned body is left
+    auto it = lru.end();
+    while (stats.residentBytes > stats.budget && stats.residentBytes > pinned && it != lru.begin()) {
+        --it;
+        Entry& e = entries[*it];
+        if (*it == keep || e.charged == 0)
+            continue;
+
+        //evicting moves the entry to spilledList, so step past it first
+        auto victim = it++;
+        if (!evict(*victim, e))
+            break;
+    }
+}
+
+bool ContentStore::openBacking() {
+    if (backing.is_open())
+        return true;
+
+    backing.open(backingPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    backingEnd = 0;
+    return backing.is_open();
+}
+
+uint64_t ContentStore::allocateExtent(uint64_t length) {
+    for (auto it = freeExtents.begin(); it != freeExtents.end(); ++it) {
+        if (it->second < length)
+            continue;
+
+        uint64_t offset = it->first;
+        uint64_t rest = it->second - length;
+        freeExtents.erase(it);
+        if (rest > 0)
+            freeExtents.emplace(offset + length, rest);
+        stats.reusableBytes -= length;
+        return offset;
+    }
+
+    uint64_t offset = backingEnd;
+    backingEnd += length;
+    stats.backingBytes = backingEnd;
+    return offset;
+}
+
+void ContentStore::freeExtent(uint64_t offset, uint64_t length) {
+    //the backing file is empty again: start it over
+    if (stats.spilledFiles == 0) {
+        freeExtents.clear();
+        backingEnd = 0;
+        stats.backingBytes = 0;
+        stats.reusableBytes = 0;
+        return;
+    }
+
+    stats.reusableBytes += length;
+
+    //merge with the holes on either side
+    auto next = freeExtents.lower_bound(offset);
+    if (next != freeExtents.end() && offset + length == next->first) {
+        length += next->second;
+        next = freeExtents.erase(next);
+    }
+    if (next != freeExtents.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            length += prev->second;
+            freeExtents.erase(prev);
+        }
+    }
+
+    //a hole at the very end just shortens the file
+    if (offset + length == backingEnd) {
+        backingEnd = offset;
+        stats.backingBytes = backingEnd;
+        stats.reusableBytes -= length;
+        return;
+    }
+    freeExtents.emplace(offset, length);
+}
+
+bool ContentStore::evict(const VFSNode* node, Entry& e) {
+    Rope& body = const_cast<VFSNode*>(node)->content;
+
+    if (!openBacking()) {
+        ++stats.spillErrors;
+        return false;
+    }
+
+    //written piece by piece; the body is never joined on its way out
+    uint64_t length = body.size();
+    uint64_t offset = allocateExtent(length);
+    backing.clear();
+    backing.seekp(static_cast<std::streamoff>(offset));
+    body.forEachPiece([&](const char* data, size_t len) {
+        backing.write(data, static_cast<std::streamsize>(len));
+    });
+    backing.flush();
+    if (!backing) {
+        ++stats.spillErrors;
+        backing.clear();
+        freeExtent(offset, length);
+        return false;
+    }
+
+    e.spilled = true;
+    e.offset = offset;
+    e.length = length;
+    spilledList.splice(spilledList.end(), lru, e.lruPos);
+
+    body.clear();
+    recharge(node, e);
+
+    ++stats.evictions;
+    ++stats.spilledFiles;
+    stats.spilledBytes += e.length;
+    return true;
+}
+
+void ContentStore::faultIn(const VFSNode* node, Entry& e) {
+    auto start = std::chrono::steady_clock::now();
+    //comes back as a single piece
+    std::string body(e.length, '\0');
+    backing.clear();
+    backing.seekg(static_cast<std::streamoff>(e.offset));
+    if (e.length > 0)
+        backing.read(&body[0], static_cast<std::streamsize>(e.length));
+    if (!backing) {
+        ++stats.spillErrors;
+        backing.clear();
+    }
+    const_cast<VFSNode*>(node)->content.assign(std::move(body));
+
+    e.spilled = false;
+    --stats.spilledFiles;
+    stats.spilledBytes -= e.length;
+    recharge(node, e);
+
+    freeExtent(e.offset, e.length);
+
+    auto nanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    ++stats.faults;
+    stats.faultNanosTotal += nanos;
+    stats.faultNanosMax = std::max(stats.faultNanosMax, nanos);
+}
+
+void ContentStore::setBudget(size_t bytes) {
+    stats.budget = bytes;
+    enforceBudget(nullptr);
+}
+
+void ContentStore::hold() {
+    ++holds;
+}
+
+void ContentStore::release() {
+    if (holds > 0 && --holds == 0)
+        enforceBudget(nullptr);
+}
+
+void ContentStore::touch(const VFSNode* node) {
+    Entry& e = track(node);
+    if (e.spilled)
+        faultIn(node, e);
+    else
+        recharge(node, e);
+    enforceBudget(node);
+}
+
+void ContentStore::replaced(const VFSNode* node) {
+    Entry& e = track(node);
+    if (e.spilled) {
+        e.spilled = false;
+        --stats.spilledFiles;
+        stats.spilledBytes -= e.length;
+        freeExtent(e.offset, e.length);
+    }
+    recharge(node, e);
+    enforceBudget(node);
+}
+
+void ContentStore::forget(const VFSNode* node) {
+    auto it = entries.find(node);
+    if (it == entries.end())
+        return;
+
+    Entry& e = it->second;
+    stats.residentBytes -= e.charged;
+    if (e.spilled) {
+        --stats.spilledFiles;
+        stats.spilledBytes -= e.length;
+        freeExtent(e.offset, e.length);
+    }
+    (e.spilled ? spilledList : lru).erase(e.lruPos);
+    entries.erase(it);
+}
+
+size_t ContentStore::indexBytes() const {
+    //hash nodes carry a next pointer and the cached hash; list nodes two links
+    size_t entryNode = sizeof(std::pair<const VFSNode* const, Entry>) + 2 * sizeof(void*);
+    size_t lruNode = sizeof(const VFSNode*) + 2 * sizeof(void*);
+    size_t extentNode = sizeof(std::pair<const uint64_t, uint64_t>) + 4 * sizeof(void*);
+    return entries.size() * entryNode + entries.bucket_count() * sizeof(void*) + (lru.size() + spilledList.size()) * lruNode
+        + freeExtents.size() * extentNode;
+}
+
+size_t ContentStore::contentSize(const VFSNode* node) const {
+    auto it = entries.find(node);
+    if (it != entries.end() && it->second.spilled)
+        return it->second.length;
+    return node->content.size();
+}
+
+bool ContentStore::readChunks(const VFSNode* node,
+    const std::function<void(const char*, size_t)>& sink) const {
+    auto it = entries.find(node);
+    if (it == entries.end() || !it->second.spilled) {
+        node->content.forEachPiece(sink);
+        return true;
+    }
+
+    //own handle so concurrent readers do not share a file position
+    std::ifstream in(backingPath, std::ios::binary);
+    if (!in)
+        return false;
+    in.seekg(static_cast<std::streamoff>(it->second.offset));
+
+    std::vector<char> buffer(64 * 1024);
+    size_t left = it->second.length;
+    while (left > 0) {
+        size_t n = std::min(left, buffer.size());
+        in.read(buffer.data(), static_cast<std::streamsize>(n));
+        if (in.gcount() != static_cast<std::streamsize>(n))
+            return false;
+        sink(buffer.data(), n);
+        left -= n;
+    }
+    return true;
+}
+
+const ContentStore::Stats& ContentStore::getStats() const {
+    return stats;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <map>
+#include <fstream>
+#include <functional>
+#include <cstdint>
+
+class VFSNode;
+
+//keeps file bodies within a memory budget. cold bodies are appended to a
+//backing file in LRU order and read back the next time they are touched.
+class ContentStore {
+public:
+    struct Stats {
+        size_t budget;
+        size_t residentBytes;
+        size_t spilledBytes;
+        size_t spilledFiles;
+        uint64_t evictions;
+        uint64_t faults;
+        uint64_t faultNanosTotal;
+        uint64_t faultNanosMax;
+        uint64_t spillErrors;
+        uint64_t backingBytes;  //length of the backing file in use
+        uint64_t reusableBytes; //freed extents inside it, waiting to be reused
+    };
+
+private:
+    struct Entry {
+        std::list<const VFSNode*>::iterator lruPos; //in lru, or in spilledList while spilled
+        size_t charged;     //bytes counted towards residentBytes
+        bool spilled;
+        uint64_t offset;    //location in the backing file while spilled
+        size_t length;
+    };
+
+    std::string backingPath;
+    std::fstream backing;
+    uint64_t backingEnd;
+
+    //holes left by bodies that were paged back in or replaced, by offset.
+    //evictions fill the first hole big enough before growing the file
+    std::map<uint64_t, uint64_t> freeExtents;
+
+    std::list<const VFSNode*> lru; //resident bodies, front = most recently used
+    std::list<const VFSNode*> spilledList; //kept apart so eviction only walks resident bodies
+    int holds;
+    std::unordered_map<const VFSNode*, Entry> entries;
+    Stats stats;
+
+    Entry& track(const VFSNode* node);
+    void recharge(const VFSNode* node, Entry& e);
+    void enforceBudget(const VFSNode* keep);
+    bool evict(const VFSNode* node, Entry& e);
+    void faultIn(const VFSNode* node, Entry& e);
+    bool openBacking();
+    uint64_t allocateExtent(uint64_t length);
+    void freeExtent(uint64_t offset, uint64_t length);
+
+public:
+    explicit ContentStore(const std::string& backingPath);
+    ~ContentStore();
+
+    ContentStore(const ContentStore&) = delete;
+    ContentStore& operator=(const ContentStore&) = delete;
+
+    //0 means unlimited
+    void setBudget(size_t bytes);
+
+    //the body is about to be read or edited: page it in and mark it hot
+    void touch(const VFSNode* node);
+
+    //the body was just replaced wholesale: drop any spilled copy
+    void replaced(const VFSNode* node);
+
+    //nested holds postpone eviction so outstanding views stay valid
+    void hold();
+    void release();
+
+    //node is going away
+    void forget(const VFSNode* node);
+
+    //read a body without paging it in. safe to call from several threads
+    //as long as nothing touches the store meanwhile
+    size_t contentSize(const VFSNode* node) const;
+    bool readChunks(const VFSNode* node,
+        const std::function<void(const char*, size_t)>& sink) const;
+
+    const Stats& getStats() const;
+
+    //heap used by the LRU list and the tracking table
+    size_t indexBytes() const;
+};
@@ -0,0 +1,221 @@
+#include "EventStream.h"
+
+#include <thread>
+#include <cstring>
+
+namespace {
+
+const size_t PAYLOAD_BYTES = (EventStream::SLOT_WORDS - 1) * 8;
+
+//header word: kind | truncated << 8 | path length << 16 | target length << 32
+uint64_t packHeader(VfsEvent::Kind kind, bool truncated, size_t pathLen, size_t targetLen) {
+    return uint64_t(kind) | (uint64_t(truncated) << 8) | (uint64_t(pathLen) << 16) | (uint64_t(targetLen) << 32);
+}
+
+bool underPrefix(const std::string& prefix, std::string_view path) {
+    if (prefix == "/")
+        return !path.empty();
+    return path.size() >= prefix.size() && path.compare(0, prefix.size(), prefix) == 0
+        && (path.size() == prefix.size() || path[prefix.size()] == '/');
+}
+
+bool matches(const std::string& prefix, const VfsEvent& ev) {
+    if (underPrefix(prefix, ev.path) || underPrefix(prefix, ev.target))
+        return true;
+
+    //the watched directory itself went away with one of its ancestors
+    if (ev.kind == VfsEvent::Kind::Remove || ev.kind == VfsEvent::Kind::Move)
+        return underPrefix(ev.path, prefix);
+    return false;
+}
+
+}
+
+const char* eventKindName(VfsEvent::Kind kind) {
+    switch (kind) {
+    case VfsEvent::Kind::Create:   return "create";
+    case VfsEvent::Kind::Write:    return "write";
+    case VfsEvent::Kind::Remove:   return "remove";
+    case VfsEvent::Kind::Copy:     return "copy";
+    case VfsEvent::Kind::Move:     return "move";
+    case VfsEvent::Kind::Chmod:    return "chmod";
+    case VfsEvent::Kind::Overflow: return "overflow";
+    }
+    return "unknown";
+}
+
+EventSubscription::EventSubscription()
+    : stream(nullptr), cursor(0) {
+}
+
+EventSubscription::~EventSubscription() {
+    if (stream)
+        stream->unsubscribe(*this);
+}
+
+const std::string& EventSubscription::getPrefix() const {
+    return prefix;
+}
+
+bool EventSubscription::isActive() const {
+    return stream != nullptr;
+}
+
+EventStream::EventStream()
+    : head(0), subscribers(0) {
+}
+
+void EventStream::publish(VfsEvent::Kind kind, std::string_view path, std::string_view target) {
+    if (!active())
+        return;
+
+    uint64_t ticket = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[ticket & (SLOT_COUNT - 1)];
+    uint64_t writing = 2 * ticket + 1;
+
+    //claim the slot. a writer from the previous lap that is still copying is
+    //waited out; if a later lap already owns it, this event is lost and
+    //readers see it as an overflow
+    uint64_t cur = slot.seq.load(std::memory_order_acquire);
+    for (;;) {
+        if (cur >= writing)
+            return;
+        if (cur & 1) {
+            std::this_thread::yield();
+            cur = slot.seq.load(std::memory_order_acquire);
+            continue;
+        }
+        if (slot.seq.compare_exchange_weak(cur, writing, std::memory_order_acquire))
+            break;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t pathLen = path.size() < PAYLOAD_BYTES ? path.size() : PAYLOAD_BYTES;
+    size_t targetLen = target.size() < PAYLOAD_BYTES - pathLen ? target.size() : PAYLOAD_BYTES - pathLen;
+    bool truncated = pathLen < path.size() || targetLen < target.size();
+
+    uint64_t payload[SLOT_WORDS - 1] = {};
+    char* bytes = reinterpret_cast<char*>(payload);
+    std::memcpy(bytes, path.data(), pathLen);
+    std::memcpy(bytes + pathLen, target.data(), targetLen);
+
+    slot.words[0].store(packHeader(kind, truncated, pathLen, targetLen), std::memory_order_relaxed);
+    size_t used = (pathLen + targetLen + 7) / 8;
+    for (size_t i = 0; i < used; ++i)
+        slot.words[i + 1].store(payload[i], std::memory_order_relaxed);
+
+    slot.seq.store(writing + 1, std::memory_order_release);
+}
+
+bool EventStream::readSlot(uint64_t ticket, VfsEvent& ev, bool& overwritten) const {
+    const Slot& slot = slots[ticket & (SLOT_COUNT - 1)];
+    uint64_t ready = 2 * ticket + 2;
+
+    uint64_t before = slot.seq.load(std::memory_order_acquire);
+    overwritten = before > ready;
+    if (before != ready)
+        return false;
+
+    uint64_t header = slot.words[0].load(std::memory_order_relaxed);
+    size_t pathLen = (header >> 16) & 0xffff;
+    size_t targetLen = (header >> 32) & 0xffff;
+    if (pathLen + targetLen > PAYLOAD_BYTES)
+        pathLen = targetLen = 0; //torn header; rejected by the check below
+
+    uint64_t payload[SLOT_WORDS - 1];
+    size_t used = (pathLen + targetLen + 7) / 8;
+    for (size_t i = 0; i < used; ++i)
+        payload[i] = slot.words[i + 1].load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != before) {
+        overwritten = true;
+        return false;
+    }
+
+    const char* bytes = reinterpret_cast<const char*>(payload);
+    ev.kind = static_cast<VfsEvent::Kind>(header & 0xff);
+    ev.truncated = ((header >> 8) & 1) != 0;
+    ev.path.assign(bytes, pathLen);
+    ev.target.assign(bytes + pathLen, targetLen);
+    ev.lost = 0;
+    return true;
+}
+
+void EventStream::subscribe(EventSubscription& sub, const std::string& prefix) {
+    if (sub.stream)
+        sub.stream->unsubscribe(sub);
+
+    std::call_once(allocated, [this] {
+        slots.reset(new Slot[SLOT_COUNT]);
+        for (size_t i = 0; i < SLOT_COUNT; ++i) {
+            //0 sorts below the sequence of every ticket that maps here
+            slots[i].seq.store(0, std::memory_order_relaxed);
+            for (auto& w : slots[i].words)
+                w.store(0, std::memory_order_relaxed);
+        }
+    });
+
+    sub.stream = this;
+    sub.prefix = prefix;
+    sub.cursor = head.load(std::memory_order_acquire);
+    subscribers.fetch_add(1, std::memory_order_release);
+}
+
+void EventStream::unsubscribe(EventSubscription& sub) {
+    if (sub.stream != this)
+        return;
+    subscribers.fetch_sub(1, std::memory_order_release);
+    sub.stream = nullptr;
+}
+
+size_t EventStream::poll(EventSubscription& sub, std::vector<VfsEvent>& out, size_t max) {
+    if (sub.stream != this)
+        return 0;
+
+    size_t added = 0;
+    uint64_t lost = 0;
+
+    auto flushLost = [&] {
+        if (lost == 0) return;
+        out.push_back(VfsEvent{ VfsEvent::Kind::Overflow, sub.prefix, "", lost, false });
+        ++added;
+        lost = 0;
+    };
+
+    while (added < max) {
+        uint64_t end = head.load(std::memory_order_acquire);
+        if (sub.cursor >= end)
+            break;
+
+        //anything more than one lap behind has already been overwritten
+        if (end - sub.cursor > SLOT_COUNT) {
+            lost += end - SLOT_COUNT - sub.cursor;
+            sub.cursor = end - SLOT_COUNT;
+        }
+
+        VfsEvent ev;
+        bool overwritten = false;
+        if (!readSlot(sub.cursor, ev, overwritten)) {
+            if (!overwritten)
+                break; //claimed but not published yet
+            ++lost;
+            ++sub.cursor;
+            continue;
+        }
+        ++sub.cursor;
+
+        if (!matches(sub.prefix, ev))
+            continue;
+        flushLost();
+        out.push_back(std::move(ev));
+        ++added;
+    }
+
+    flushLost();
+    return added;
+}
+
+size_t EventStream::ringBytes() const {
+    return slots ? SLOT_COUNT * sizeof(Slot) : 0;
+}
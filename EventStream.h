@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+//one change to the tree. paths are absolute
+struct VfsEvent {
+    enum class Kind : uint8_t {
+        Create,
+        Write,
+        Remove,
+        Copy,
+        Move,
+        Chmod,
+        Overflow    //the subscriber fell behind and `lost` events were dropped
+    };
+
+    Kind kind;
+    std::string path;   //source for Copy/Move
+    std::string target; //destination for Copy/Move
+    uint64_t lost;
+    bool truncated;     //paths did not fit in a slot and were cut short
+};
+
+const char* eventKindName(VfsEvent::Kind kind);
+
+class EventStream;
+
+//a reader's position in the stream plus its subtree filter. unsubscribes
+//itself when destroyed
+class EventSubscription {
+private:
+    friend class EventStream;
+
+    EventStream* stream;
+    uint64_t cursor;    //next ticket to read
+    std::string prefix;
+
+public:
+    EventSubscription();
+    ~EventSubscription();
+
+    EventSubscription(const EventSubscription&) = delete;
+    EventSubscription& operator=(const EventSubscription&) = delete;
+
+    const std::string& getPrefix() const;
+    bool isActive() const;
+};
+
+//bounded broadcast ring of change events.
+//
+//writers claim a ticket with one fetch_add and fill the slot under a
+//per-slot sequence number (odd while writing, even once published), so
+//they never take a lock and never wait for readers. every subscriber keeps
+//its own cursor and validates each slot against the sequence number; a
+//reader that has been lapped gets an Overflow event with the number of
+//events it missed instead of holding writers back.
+//
+//nothing is allocated or formatted until the first subscriber arrives,
+//and publish() is a single atomic load while nobody is listening
+class EventStream {
+public:
+    static const size_t SLOT_COUNT = 1024;    //power of two
+    static const size_t SLOT_WORDS = 32;      //header word + 248 bytes of path
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> words[SLOT_WORDS];
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    std::once_flag allocated;
+    std::atomic<uint64_t> head;         //next ticket to hand out
+    std::atomic<unsigned> subscribers;
+
+    bool readSlot(uint64_t ticket, VfsEvent& ev, bool& overwritten) const;
+
+public:
+    EventStream();
+
+    EventStream(const EventStream&) = delete;
+    EventStream& operator=(const EventStream&) = delete;
+
+    bool active() const {
+        return subscribers.load(std::memory_order_acquire) != 0;
+    }
+
+    void publish(VfsEvent::Kind kind, std::string_view path, std::string_view target = {});
+
+    //starts at the current end of the stream; only events under `prefix`
+    //(or removals/moves of one of its ancestors) are delivered
+    void subscribe(EventSubscription& sub, const std::string& prefix);
+    void unsubscribe(EventSubscription& sub);
+
+    //appends up to `max` pending events for this subscriber and returns how many
+    size_t poll(EventSubscription& sub, std::vector<VfsEvent>& out, size_t max);
+
+    size_t ringBytes() const;
+};
@@ -0,0 +1,194 @@
+#include "Journal.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint32_t RECORD_MAGIC = 0x4a585456; //"VTXJ"
+const uint64_t NO_FAILURE = ~uint64_t(0);
+
+struct CrcTable {
+    uint32_t entries[256];
+
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32(const std::string& data) {
+    //built once, thread-safely, by whichever journal gets there first
+    static const CrcTable crcTable;
+    const uint32_t* table = crcTable.entries;
+
+    uint32_t crc = 0xffffffffu;
+    for (unsigned char ch : data)
+        crc = table[(crc ^ ch) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+void putU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+uint32_t getU32(const unsigned char* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+bool syncFile(std::FILE* f) {
+    if (std::fflush(f) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+}
+
+Journal::Journal(const std::string& path)
+    : path(path), file(nullptr), nextTicket(0), handledTicket(0),
+    failedFrom(NO_FAILURE), flushing(false), stats() {
+    //the crc table is built on first use; do it before any committer threads exist
+    crc32("");
+}
+
+Journal::~Journal() {
+    if (file)
+        std::fclose(file);
+}
+
+bool Journal::openForAppend() {
+    if (!file)
+        file = std::fopen(path.c_str(), "ab");
+    return file != nullptr;
+}
+
+uint64_t Journal::enqueue(std::string record) {
+    std::lock_guard<std::mutex> lock(mtx);
+    queued.push_back(std::move(record));
+    return nextTicket++;
+}
+
+bool Journal::waitDurable(uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (handledTicket <= ticket) {
+        if (flushing) {
+            cv.wait(lock);
+            continue;
+        }
+
+        //become the leader for everything queued so far
+        flushing = true;
+        std::vector<std::string> batch;
+        batch.swap(queued);
+        uint64_t batchStart = handledTicket;
+        uint64_t batchEnd = nextTicket;
+        bool broken = failedFrom != NO_FAILURE;
+        lock.unlock();
+
+        std::string frame;
+        for (const auto& rec : batch) {
+            putU32(frame, RECORD_MAGIC);
+            putU32(frame, static_cast<uint32_t>(rec.size()));
+            putU32(frame, crc32(rec));
+            frame += rec;
+        }
+
+        bool ok = !broken
+            && openForAppend()
+            && std::fwrite(frame.data(), 1, frame.size(), file) == frame.size()
+            && syncFile(file);
+
+        lock.lock();
+        if (!ok) {
+            if (failedFrom == NO_FAILURE)
+                failedFrom = batchStart;
+        }
+        else {
+            stats.records += batch.size();
+            ++stats.syncs;
+        }
+        handledTicket = batchEnd;
+        flushing = false;
+        cv.notify_all();
+    }
+
+    return ticket < failedFrom;
+}
+
+uint64_t Journal::replay(const std::function<void(const std::string&)>& apply) {
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (!in)
+        return 0;
+
+    uint64_t kept = 0;
+    unsigned char header[12];
+    while (std::fread(header, 1, sizeof(header), in) == sizeof(header)) {
+        if (getU32(header) != RECORD_MAGIC)
+            break;
+
+        uint32_t len = getU32(header + 4);
+        std::string rec(len, '\0');
+        if (len > 0 && std::fread(&rec[0], 1, len, in) != len)
+            break;
+        if (crc32(rec) != getU32(header + 8))
+            break;
+
+        apply(rec);
+        kept += sizeof(header) + len;
+    }
+    std::fclose(in);
+
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec || size <= kept)
+        return 0;
+
+    {
+        //the append handle is reopened on the next commit
+        std::lock_guard<std::mutex> lock(mtx);
+        if (file) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+    std::filesystem::resize_file(path, kept, ec);
+    return ec ? 0 : size - kept;
+}
+
+void Journal::reset() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return !flushing; });
+
+    //whatever is still queued was applied before the snapshot was taken;
+    //writing it to the fresh journal would replay it a second time
+    queued.clear();
+    handledTicket = nextTicket;
+    failedFrom = NO_FAILURE;
+    cv.notify_all();
+
+    if (file) {
+        std::fclose(file);
+        file = nullptr;
+    }
+    std::remove(path.c_str());
+}
+
+Journal::Stats Journal::getStats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return stats;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+//append-only redo log for committed transactions. records are framed with
+//a length and checksum so a torn tail is detected on replay and cut off.
+//
+//commits use group commit: whoever finds no flush in progress becomes the
+//leader and writes every queued record with a single write + sync, while
+//the other committers wait for it instead of issuing their own.
+class Journal {
+public:
+    struct Stats {
+        uint64_t records;
+        uint64_t syncs;     //one per group of records written together
+    };
+
+private:
+    std::string path;
+    std::FILE* file;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::string> queued;
+    uint64_t nextTicket;    //ticket of the next enqueued record
+    uint64_t handledTicket; //every ticket below this has been written out
+    //first ticket of the first batch whose write failed. records after a
+    //missing one would replay over the wrong state, so from here on nothing
+    //is written and every ticket fails until reset()
+    uint64_t failedFrom;
+    bool flushing;
+    Stats stats;
+
+    bool openForAppend();
+
+public:
+    explicit Journal(const std::string& path);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    //two-phase commit so callers can release their own locks in between
+    uint64_t enqueue(std::string record);
+    bool waitDurable(uint64_t ticket);
+
+    //calls `apply` for every intact record in order. a damaged tail is cut
+    //off so new commits are not appended behind it, where replay would
+    //never reach them. returns the number of bytes cut
+    uint64_t replay(const std::function<void(const std::string&)>& apply);
+
+    //drop everything; called once a full snapshot has been written. records
+    //still queued are settled as durable, since the snapshot holds them
+    void reset();
+
+    //counted since startup; reset() does not clear them
+    Stats getStats();
+};
@@ -0,0 +1,219 @@
+#include "LoadGenerator.h"
+#include "Protocol.h"
+
+#include <iostream>
+
+#ifdef __linux__
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const unsigned BENCH_FILES = 64;
+
+int connectTo(const std::string& path, bool nonBlocking) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0), 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//blocking round trip, used for setup only
+bool roundTrip(int fd, ProtoOp op, const std::vector<std::string_view>& args) {
+    std::string out;
+    encodeRequest(out, op, 0, args);
+    if (send(fd, out.data(), out.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(out.size()))
+        return false;
+
+    std::string in;
+    char buf[4096];
+    while (frameLength(in) == 0) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        in.append(buf, static_cast<size_t>(n));
+    }
+    return true;
+}
+
+struct Session {
+    int fd;
+    unsigned sent;
+    std::string out;
+    size_t outPos;
+    std::string in;
+    Clock::time_point started;
+};
+
+}
+
+int runLoadGenerator(const std::string& socketPath, unsigned connections, unsigned requests) {
+    std::signal(SIGPIPE, SIG_IGN);
+    if (connections == 0) connections = 1;
+    if (requests == 0) requests = 1;
+
+    //a small working set so cat has something to read
+    int setup = connectTo(socketPath, false);
+    if (setup < 0) {
+        std::cout << "loadgen: cannot connect to " << socketPath << "\n";
+        return 1;
+    }
+    roundTrip(setup, ProtoOp::Mkdir, { "/bench" });
+    std::string body(512, 'x');
+    for (unsigned i = 0; i < BENCH_FILES; ++i) {
+        std::string name = "/bench/f" + std::to_string(i);
+        roundTrip(setup, ProtoOp::Write, { name, body });
+    }
+    close(setup);
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Session> sessions(connections);
+    for (unsigned i = 0; i < connections; ++i) {
+        sessions[i].fd = connectTo(socketPath, true);
+        if (sessions[i].fd < 0) {
+            std::cout << "loadgen: connection " << i << " failed\n";
+            return 1;
+        }
+        sessions[i].sent = 0;
+        sessions[i].outPos = 0;
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, sessions[i].fd, &ev);
+    }
+
+    //70% cat, 20% ls, 10% write
+    std::mt19937 rng(12345);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(size_t(connections) * requests);
+    uint64_t failures = 0;
+
+    auto queueNext = [&](Session& s) {
+        unsigned pick = rng() % 10;
+        std::string file = "/bench/f" + std::to_string(rng() % BENCH_FILES);
+        s.out.clear();
+        s.outPos = 0;
+        if (pick < 7)
+            encodeRequest(s.out, ProtoOp::Cat, 0, { file });
+        else if (pick < 9)
+            encodeRequest(s.out, ProtoOp::Ls, 0, { "/bench" });
+        else
+            encodeRequest(s.out, ProtoOp::Write, 0, { file, body });
+        s.started = Clock::now();
+        ++s.sent;
+    };
+
+    for (auto& s : sessions)
+        queueNext(s);
+
+    unsigned active = connections;
+    auto begin = Clock::now();
+    std::vector<epoll_event> events(256);
+    char buf[64 * 1024];
+
+    while (active > 0) {
+        int n = epoll_wait(ep, events.data(), static_cast<int>(events.size()), 5000);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            std::cout << "loadgen: server stopped responding\n";
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            Session& s = sessions[events[i].data.u32];
+            if (s.fd < 0) continue;
+
+            if ((events[i].events & EPOLLOUT) && s.outPos < s.out.size()) {
+                ssize_t w = send(s.fd, s.out.data() + s.outPos, s.out.size() - s.outPos, MSG_NOSIGNAL);
+                if (w > 0) s.outPos += static_cast<size_t>(w);
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ssize_t r = recv(s.fd, buf, sizeof(buf), 0);
+                if (r <= 0 && !(r < 0 && (errno == EAGAIN || errno == EINTR))) {
+                    close(s.fd);
+                    s.fd = -1;
+                    --active;
+                    ++failures;
+                    continue;
+                }
+                if (r > 0) s.in.append(buf, static_cast<size_t>(r));
+
+                size_t len = frameLength(s.in);
+                if (len > 0 && len != SIZE_MAX) {
+                    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - s.started).count();
+                    latencies.push_back(static_cast<uint64_t>(nanos));
+
+                    uint8_t status = 0;
+                    std::string_view payload;
+                    if (!decodeResponse(std::string_view(s.in).substr(0, len), status, payload) || status != 0)
+                        ++failures;
+                    s.in.erase(0, len);
+
+                    if (s.sent < requests) {
+                        queueNext(s);
+                    }
+                    else {
+                        epoll_ctl(ep, EPOLL_CTL_DEL, s.fd, nullptr);
+                        close(s.fd);
+                        s.fd = -1;
+                        --active;
+                    }
+                }
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    close(ep);
+    for (auto& s : sessions)
+        if (s.fd >= 0) close(s.fd);
+
+    if (latencies.empty()) {
+        std::cout << "loadgen: no requests completed\n";
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) {
+        size_t idx = static_cast<size_t>(p * (latencies.size() - 1));
+        return latencies[idx] / 1000.0;
+    };
+
+    std::cout << "connections:  " << connections << "\n";
+    std::cout << "requests:     " << latencies.size() << " (" << failures << " failed)\n";
+    std::cout << "elapsed:      " << seconds << " s\n";
+    std::cout << "throughput:   " << static_cast<uint64_t>(latencies.size() / seconds) << " req/s\n";
+    std::cout << "latency us:   p50 " << pct(0.50) << "  p90 " << pct(0.90) << "  p99 " << pct(0.99)
+        << "  p99.9 " << pct(0.999) << "  max " << latencies.back() / 1000.0 << "\n";
+    return failures == 0 ? 0 : 1;
+}
+
+#else
+
+int runLoadGenerator(const std::string&, unsigned, unsigned) {
+    std::cout << "loadgen: needs Linux (epoll)\n";
+    return 1;
+}
+
+#endif
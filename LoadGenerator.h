@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+//closed-loop load generator for the socket server: keeps `connections`
+//sessions busy with one request each until every session has sent
+//`requests`, then prints throughput and latency percentiles.
+//returns a process exit code
+int runLoadGenerator(const std::string& socketPath, unsigned connections, unsigned requests);
@@ -0,0 +1,253 @@
+#include "Pipeline.h"
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+std::vector<std::string> tokenize(const std::string& text) {
+    std::vector<std::string> tokens;
+    std::stringstream ss(text);
+    std::string tok;
+    while (ss >> tok)
+        tokens.push_back(tok);
+    return tokens;
+}
+
+std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t");
+    if (b == std::string::npos) return "";
+    size_t e = s.find_last_not_of(" \t");
+    return s.substr(b, e - b + 1);
+}
+
+size_t parseCount(const std::vector<std::string>& args, size_t fallback) {
+    //accepts "head 5" and "head -n 5"
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-n") continue;
+        try {
+            return static_cast<size_t>(std::stoul(args[i]));
+        }
+        catch (...) {
+            return fallback;
+        }
+    }
+    return fallback;
+}
+
+}
+
+Pipeline::Pipeline(VirtualFileSystem& vfsRef, std::ostream& out)
+    : vfs(vfsRef), console(out) {
+}
+
+bool Pipeline::isPipeline(const std::string& line) {
+    return line.find('|') != std::string::npos || line.find('>') != std::string::npos;
+}
+
+std::string_view Pipeline::keep(std::string text) {
+    owned.push_back(std::make_unique<std::string>(std::move(text)));
+    return *owned.back();
+}
+
+Pipeline::Segments Pipeline::splitLines(const Segments& input) {
+    //one view per line, newline included. a line that straddles two
+    //segments is the only thing that ever gets copied here
+    Segments lines;
+    std::string partial;
+
+    for (std::string_view seg : input) {
+        size_t start = 0;
+        while (start < seg.size()) {
+            size_t nl = seg.find('\n', start);
+            size_t end = (nl == std::string_view::npos) ? seg.size() : nl + 1;
+
+            if (!partial.empty()) {
+                partial.append(seg.data() + start, end - start);
+                if (nl != std::string_view::npos) {
+                    lines.push_back(keep(std::move(partial)));
+                    partial.clear();
+                }
+            }
+            else if (nl == std::string_view::npos) {
+                partial.assign(seg.data() + start, end - start);
+            }
+            else {
+                lines.push_back(seg.substr(start, end - start));
+            }
+            start = end;
+        }
+    }
+
+    if (!partial.empty())
+        lines.push_back(keep(std::move(partial)));
+    return lines;
+}
+
+bool Pipeline::runSource(const std::vector<std::string>& args, Segments& out) {
+    const std::string& cmd = args[0];
+
+    if (cmd == "cat") {
+        //every piece of every file is a segment of its own, nothing is joined
+        if (args.size() < 2) {
+            console << "cat: invalid file\n";
+            return false;
+        }
+        for (size_t i = 1; i < args.size(); ++i) {
+            VfsStatus st = vfs.readFile(args[i], out);
+            if (st != VfsStatus::Ok) {
+                console << "cat: " << args[i] << ": " << statusMessage(st) << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (cmd == "echo") {
+        std::string text;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (i > 1) text += ' ';
+            text += args[i];
+        }
+        out.push_back(keep(text + "\n"));
+        return true;
+    }
+
+    //commands that only know how to print are captured once
+    std::ostringstream captured;
+    if (cmd == "ls")
+        vfs.cmdLs(captured);
+    else if (cmd == "pwd")
+        vfs.cmdPwd(captured);
+    else if (cmd == "tree")
+        vfs.cmdTree(captured);
+    else {
+        console << "pipe: " << cmd << " cannot start a pipeline\n";
+        return false;
+    }
+
+    out.push_back(keep(captured.str()));
+    return true;
+}
+
+bool Pipeline::runFilter(const std::vector<std::string>& args, const Segments& input, Segments& out) {
+    const std::string& cmd = args[0];
+
+    if (cmd == "grep") {
+        bool invert = args.size() > 1 && args[1] == "-v";
+        size_t patIndex = invert ? 2 : 1;
+        if (patIndex >= args.size()) {
+            console << "grep: missing pattern\n";
+            return false;
+        }
+
+        const std::string& pattern = args[patIndex];
+        for (std::string_view line : splitLines(input)) {
+            bool match = line.find(pattern) != std::string_view::npos;
+            if (match != invert)
+                out.push_back(line);
+        }
+        return true;
+    }
+
+    if (cmd == "head" || cmd == "tail") {
+        Segments lines = splitLines(input);
+        size_t n = std::min(parseCount(args, 10), lines.size());
+        if (cmd == "head")
+            out.assign(lines.begin(), lines.begin() + n);
+        else
+            out.assign(lines.end() - n, lines.end());
+        return true;
+    }
+
+    if (cmd == "wc") {
+        size_t lines = 0, words = 0, bytes = 0;
+        bool inWord = false;
+        for (std::string_view seg : input) {
+            bytes += seg.size();
+            for (char c : seg) {
+                if (c == '\n') ++lines;
+                bool space = c == ' ' || c == '\n' || c == '\t' || c == '\r';
+                if (!space && !inWord) ++words;
+                inWord = !space;
+            }
+        }
+        out.push_back(keep(std::to_string(lines) + " " + std::to_string(words) + " "
+            + std::to_string(bytes) + "\n"));
+        return true;
+    }
+
+    console << "pipe: " << cmd << " cannot read from a pipe\n";
+    return false;
+}
+
+bool Pipeline::run(const std::string& line) {
+    //split off the redirection first; it is always the last thing on the line
+    std::string stagesText = line;
+    std::string target;
+    bool append = false;
+
+    size_t gt = line.find('>');
+    if (gt != std::string::npos) {
+        append = gt + 1 < line.size() && line[gt + 1] == '>';
+        target = trim(line.substr(gt + (append ? 2 : 1)));
+        stagesText = line.substr(0, gt);
+
+        if (target.empty() || target.find_first_of("|> \t") != std::string::npos) {
+            console << "pipe: redirection needs exactly one target file\n";
+            return false;
+        }
+    }
+
+    std::vector<std::vector<std::string>> stages;
+    std::stringstream ss(stagesText);
+    std::string part;
+    while (std::getline(ss, part, '|')) {
+        auto args = tokenize(part);
+        if (args.empty()) {
+            console << "pipe: empty command\n";
+            return false;
+        }
+        stages.push_back(std::move(args));
+    }
+    if (stages.empty()) {
+        console << "pipe: empty command\n";
+        return false;
+    }
+
+    //views into file bodies must survive until the sink has run
+    vfs.holdContent();
+
+    Segments data;
+    bool ok = runSource(stages[0], data);
+    for (size_t i = 1; ok && i < stages.size(); ++i) {
+        Segments next;
+        ok = runFilter(stages[i], data, next);
+        data.swap(next);
+    }
+
+    if (ok) {
+        if (!target.empty()) {
+            VfsStatus st = vfs.writeFile(target, data, append);
+            if (st != VfsStatus::Ok) {
+                console << "pipe: " << target << ": " << statusMessage(st) << "\n";
+                ok = false;
+            }
+        }
+        else {
+            bool endsWithNewline = false;
+            for (std::string_view seg : data) {
+                console.write(seg.data(), static_cast<std::streamsize>(seg.size()));
+                if (!seg.empty())
+                    endsWithNewline = seg.back() == '\n';
+            }
+            if (!endsWithNewline && !data.empty())
+                console << "\n";
+        }
+    }
+
+    vfs.releaseContent();
+    owned.clear();
+    return ok;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "VirtualFileSystem.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <ostream>
+
+//runs "stage | stage ... [> file | >> file]" lines. stages hand each other
+//lists of string_views that point either into VFS file bodies or into
+//buffers owned by the pipeline, so text is only copied at the final sink.
+class Pipeline {
+private:
+    using Segments = std::vector<std::string_view>;
+
+    VirtualFileSystem& vfs;
+    std::ostream& console;
+    std::vector<std::unique_ptr<std::string>> owned;
+
+    std::string_view keep(std::string text);
+    Segments splitLines(const Segments& input);
+
+    bool runSource(const std::vector<std::string>& args, Segments& out);
+    bool runFilter(const std::vector<std::string>& args, const Segments& input, Segments& out);
+
+public:
+    //console gets the final output and any errors
+    Pipeline(VirtualFileSystem& vfs, std::ostream& console);
+
+    //true if the line uses |, > or >>
+    static bool isPipeline(const std::string& line);
+
+    bool run(const std::string& line);
+};
@@ -0,0 +1,93 @@
+#include "Protocol.h"
+
+#include <cstring>
+
+namespace {
+
+void putU32(std::string& out, uint32_t v) {
+    char b[4] = {
+        static_cast<char>(v & 0xff), static_cast<char>((v >> 8) & 0xff),
+        static_cast<char>((v >> 16) & 0xff), static_cast<char>((v >> 24) & 0xff)
+    };
+    out.append(b, 4);
+}
+
+uint32_t getU32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+}
+
+void encodeRequest(std::string& out, ProtoOp op, uint8_t flags, const std::vector<std::string_view>& args) {
+    size_t body = 3;
+    for (const auto& a : args)
+        body += 4 + a.size();
+
+    putU32(out, static_cast<uint32_t>(body));
+    out.push_back(static_cast<char>(op));
+    out.push_back(static_cast<char>(flags));
+    out.push_back(static_cast<char>(args.size()));
+    for (const auto& a : args) {
+        putU32(out, static_cast<uint32_t>(a.size()));
+        out.append(a.data(), a.size());
+    }
+}
+
+void encodeResponse(std::string& out, uint8_t status, std::string_view payload) {
+    putU32(out, static_cast<uint32_t>(payload.size() + 1));
+    out.push_back(static_cast<char>(status));
+    out.append(payload.data(), payload.size());
+}
+
+size_t frameLength(std::string_view buf) {
+    if (buf.size() < 4)
+        return 0;
+    uint32_t len = getU32(buf.data());
+    if (len > PROTO_MAX_FRAME)
+        return SIZE_MAX;
+    return buf.size() >= 4 + size_t(len) ? 4 + size_t(len) : 0;
+}
+
+bool decodeRequest(std::string_view frame, ProtoRequest& req) {
+    if (frame.size() < 7)
+        return false;
+
+    req.op = static_cast<ProtoOp>(frame[4]);
+    req.flags = static_cast<uint8_t>(frame[5]);
+    uint8_t argc = static_cast<uint8_t>(frame[6]);
+    req.args.clear();
+
+    size_t pos = 7;
+    for (uint8_t i = 0; i < argc; ++i) {
+        if (pos + 4 > frame.size())
+            return false;
+        uint32_t len = getU32(frame.data() + pos);
+        pos += 4;
+        if (pos + len > frame.size())
+            return false;
+        req.args.push_back(frame.substr(pos, len));
+        pos += len;
+    }
+    return pos == frame.size();
+}
+
+bool decodeResponse(std::string_view frame, uint8_t& status, std::string_view& payload) {
+    if (frame.size() < 5)
+        return false;
+    status = static_cast<uint8_t>(frame[4]);
+    payload = frame.substr(5);
+    return true;
+}
+
+void appendListEntry(std::string& out, bool directory, const std::string& perms, const std::string& name) {
+    out.push_back(directory ? 'd' : '-');
+    char p[3] = { '-', '-', '-' };
+    std::memcpy(p, perms.data(), perms.size() < 3 ? perms.size() : 3);
+    out.append(p, 3);
+
+    uint16_t len = static_cast<uint16_t>(name.size() > 0xffff ? 0xffff : name.size());
+    out.push_back(static_cast<char>(len & 0xff));
+    out.push_back(static_cast<char>(len >> 8));
+    out.append(name.data(), len);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+//binary protocol spoken by the socket server. all integers little-endian.
+//  request:  u32 length | u8 opcode | u8 flags | u8 argc | argc x (u32 length, bytes)
+//  response: u32 length | u8 status (VfsStatus) | payload
+//length counts the bytes after itself
+
+enum class ProtoOp : uint8_t {
+    Pwd = 1,
+    Ls,
+    Cd,
+    Mkdir,
+    Touch,
+    Rm,
+    Cat,
+    Write,
+    Cp,
+    Mv,
+    Chmod,
+    Tree,
+    Save
+};
+
+const uint8_t PROTO_FLAG_RECURSIVE = 1;
+const uint32_t PROTO_MAX_FRAME = 64 * 1024 * 1024;
+
+struct ProtoRequest {
+    ProtoOp op;
+    uint8_t flags;
+    std::vector<std::string_view> args; //views into the frame
+};
+
+void encodeRequest(std::string& out, ProtoOp op, uint8_t flags, const std::vector<std::string_view>& args);
+void encodeResponse(std::string& out, uint8_t status, std::string_view payload);
+
+//size of the first complete frame in buf (prefix included), 0 if more bytes
+//are needed, or SIZE_MAX if the frame is oversized
+size_t frameLength(std::string_view buf);
+
+//frame is one complete frame, length prefix included
+bool decodeRequest(std::string_view frame, ProtoRequest& req);
+bool decodeResponse(std::string_view frame, uint8_t& status, std::string_view& payload);
+
+//ls payload: per entry u8 type ('d' or '-'), 3 permission chars, u16 name length, name
+void appendListEntry(std::string& out, bool directory, const std::string& perms, const std::string& name);
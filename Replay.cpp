@@ -0,0 +1,192 @@
+#include "Replay.h"
+#include "Trace.h"
+#include "Shell.h"
+#include "Pipeline.h"
+#include "VirtualFileSystem.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <cstdio>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+//commands that would end the run or write shared host files
+bool skippedOnReplay(const std::string& line) {
+    std::stringstream ss(line);
+    std::string cmd, flag;
+    ss >> cmd >> flag;
+    return cmd == "exit" || cmd == "quit" || cmd == "save" || cmd == "trace"
+        || cmd == "export" || cmd == "mount" || cmd == "unmount"
+        || (cmd == "tar" && flag == "-c");
+}
+
+std::string commandName(const std::string& line) {
+    std::stringstream ss(line);
+    std::string cmd;
+    ss >> cmd;
+    return Pipeline::isPipeline(line) ? "pipe" : cmd;
+}
+
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1))] / 1000.0;
+}
+
+//swallows everything; each replay thread prints into its own
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int ch) override {
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+};
+
+struct ThreadResult {
+    std::vector<uint64_t> nanos; //per replayed record, in trace order
+};
+
+void replayThread(const std::vector<TraceRecord>& records, const std::vector<bool>& skip,
+    unsigned index, bool paced, const std::string& snapshot, Clock::time_point begin, ThreadResult& result) {
+    //a private save file per thread so spill and journal files never collide
+    std::string saveFile = "vsh-replay-" + std::to_string(index) + ".txt";
+    std::error_code ec;
+    fs::remove(saveFile, ec);
+    if (!snapshot.empty())
+        fs::copy_file(snapshot, saveFile, fs::copy_options::overwrite_existing, ec);
+
+    {
+        //the replayed commands print as they would in the shell, into a
+        //stream only this thread uses
+        NullBuffer discard;
+        std::ostream output(&discard);
+
+        VirtualFileSystem vfs(saveFile);
+        vfs.setConsole(output);
+        vfs.load();
+
+        std::istringstream input;
+        Shell shell(vfs, input, output);
+        result.nanos.reserve(records.size());
+
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (skip[i])
+                continue;
+
+            const TraceRecord& rec = records[i];
+            if (paced)
+                std::this_thread::sleep_until(begin + std::chrono::microseconds(rec.startMicros));
+
+            input.clear();
+            input.str(rec.input);
+
+            auto start = Clock::now();
+            shell.execute(rec.line);
+            result.nanos.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        }
+    }
+
+    fs::remove(saveFile, ec);
+    fs::remove(saveFile + ".journal", ec);
+}
+
+}
+
+int runTraceReplay(const std::string& tracePath, unsigned threads, bool paced, const std::string& snapshot) {
+    if (threads == 0) threads = 1;
+
+    std::vector<TraceRecord> records;
+    std::string error;
+    if (!readTrace(tracePath, records, error)) {
+        std::cout << "replay: " << error << "\n";
+        if (records.empty())
+            return 1;
+    }
+
+    if (!snapshot.empty() && !fs::exists(snapshot)) {
+        std::cout << "replay: snapshot " << snapshot << " not found\n";
+        return 1;
+    }
+
+    std::vector<bool> skip(records.size());
+    size_t skipped = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        skip[i] = skippedOnReplay(records[i].line);
+        if (skip[i]) ++skipped;
+    }
+
+    std::vector<ThreadResult> results(threads);
+    std::vector<std::thread> pool;
+    auto begin = Clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+        pool.emplace_back(replayThread, std::cref(records), std::cref(skip), t, paced,
+            std::cref(snapshot), begin, std::ref(results[t]));
+    for (auto& th : pool)
+        th.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    //latencies overall and per command, with the recorded ones beside them
+    std::vector<uint64_t> all;
+    std::map<std::string, std::vector<uint64_t>> byCommand;
+    std::map<std::string, std::vector<uint64_t>> recordedByCommand;
+    for (const auto& r : results) {
+        size_t k = 0;
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (skip[i])
+                continue;
+            all.push_back(r.nanos[k]);
+            byCommand[commandName(records[i].line)].push_back(r.nanos[k]);
+            ++k;
+        }
+    }
+
+    std::vector<uint64_t> recorded;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (skip[i])
+            continue;
+        recorded.push_back(records[i].durationMicros * 1000);
+        recordedByCommand[commandName(records[i].line)].push_back(records[i].durationMicros * 1000);
+    }
+
+    std::sort(all.begin(), all.end());
+    std::sort(recorded.begin(), recorded.end());
+
+    std::cout << "trace:        " << tracePath << " (" << records.size() << " commands, "
+        << skipped << " skipped)\n";
+    std::cout << "threads:      " << threads << (paced ? " (original pacing)" : " (as fast as possible)") << "\n";
+    std::cout << "elapsed:      " << seconds << " s\n";
+    if (seconds > 0)
+        std::cout << "throughput:   " << static_cast<uint64_t>(all.size() / seconds) << " commands/s\n";
+    std::cout << "latency us:   p50 " << percentile(all, 0.50) << "  p90 " << percentile(all, 0.90)
+        << "  p99 " << percentile(all, 0.99) << "  p99.9 " << percentile(all, 0.999)
+        << "  max " << (all.empty() ? 0 : all.back() / 1000.0) << "\n";
+    std::cout << "recorded us:  p50 " << percentile(recorded, 0.50) << "  p90 " << percentile(recorded, 0.90)
+        << "  p99 " << percentile(recorded, 0.99) << "  max " << (recorded.empty() ? 0 : recorded.back() / 1000.0) << "\n";
+
+    std::cout << "\ncommand      count      p50 us      p99 us   recorded p50\n";
+    for (auto& kv : byCommand) {
+        auto& lat = kv.second;
+        auto& rec = recordedByCommand[kv.first];
+        std::sort(lat.begin(), lat.end());
+        std::sort(rec.begin(), rec.end());
+
+        char row[128];
+        std::snprintf(row, sizeof(row), "%-10s %7zu %11.1f %11.1f %14.1f\n", kv.first.c_str(), lat.size(),
+            percentile(lat, 0.50), percentile(lat, 0.99), percentile(rec, 0.50));
+        std::cout << row;
+    }
+    return 0;
+}
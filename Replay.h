@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+//replays a trace recorded with `trace start` through the shell, once per
+//thread, each thread with its own VirtualFileSystem built either fresh or
+//from a copy of `snapshot`. `paced` keeps the recorded gaps between
+//commands; otherwise commands run back to back. prints throughput and
+//latency percentiles and returns a process exit code
+int runTraceReplay(const std::string& tracePath, unsigned threads, bool paced, const std::string& snapshot);
@@ -0,0 +1,295 @@
+#include "Rope.h"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+namespace {
+
+//every rope gets its own priority sequence. ropes built from the same
+//seed hand out the same priorities, and appending one to another then
+//stacks the pieces into a chain instead of a tree
+uint32_t freshSeed() {
+    static std::atomic<uint32_t> ropes{ 0 };
+    uint32_t x = ropes.fetch_add(1, std::memory_order_relaxed) * 0x9e3779b9u + 0x7f4a7c15u;
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x ? x : 0x9e3779b9u; //xorshift never leaves 0
+}
+
+}
+
+Rope::Piece::~Piece() {
+    std::vector<Ptr> stack;
+    if (left) stack.push_back(std::move(left));
+    if (right) stack.push_back(std::move(right));
+    while (!stack.empty()) {
+        Ptr p = std::move(stack.back());
+        stack.pop_back();
+        if (p->left) stack.push_back(std::move(p->left));
+        if (p->right) stack.push_back(std::move(p->right));
+    }
+}
+
+Rope::Rope() : seed(freshSeed()) {
+}
+
+Rope::Rope(const Rope& other) : seed(freshSeed()) {
+    root = clone(other.root.get());
+}
+
+Rope::Rope(Rope&& other) noexcept : root(std::move(other.root)), seed(other.seed) {
+}
+
+Rope& Rope::operator=(const Rope& other) {
+    if (this != &other)
+        root = clone(other.root.get());
+    return *this;
+}
+
+Rope& Rope::operator=(Rope&& other) noexcept {
+    root = std::move(other.root);
+    return *this;
+}
+
+uint32_t Rope::nextRandom() {
+    //xorshift; priorities only have to look random to keep the tree shallow
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+Rope::Ptr Rope::makePiece(std::string text) {
+    Ptr p = std::make_unique<Piece>();
+    p->text = std::move(text);
+    p->priority = nextRandom();
+    update(p.get());
+    return p;
+}
+
+Rope::Ptr Rope::build(std::string_view data) {
+    Ptr tree;
+    for (size_t at = 0; at < data.size(); at += PIECE_BYTES)
+        tree = merge(std::move(tree), makePiece(std::string(data.substr(at, PIECE_BYTES))));
+    return tree;
+}
+
+void Rope::update(Piece* p) {
+    p->total = p->text.size();
+    p->count = 1;
+    if (p->left) {
+        p->total += p->left->total;
+        p->count += p->left->count;
+    }
+    if (p->right) {
+        p->total += p->right->total;
+        p->count += p->right->count;
+    }
+}
+
+Rope::Ptr Rope::merge(Ptr a, Ptr b) {
+    if (!a) return b;
+    if (!b) return a;
+
+    //ties are settled by a coin flip; always favouring one side turns
+    //repeated equal priorities into a chain
+    if (a->priority > b->priority || (a->priority == b->priority && (nextRandom() & 1))) {
+        a->right = merge(std::move(a->right), std::move(b));
+        update(a.get());
+        return a;
+    }
+    b->left = merge(std::move(a), std::move(b->left));
+    update(b.get());
+    return b;
+}
+
+void Rope::split(Ptr p, size_t bytes, Ptr& left, Ptr& right) {
+    if (!p) {
+        left.reset();
+        right.reset();
+        return;
+    }
+
+    size_t leftTotal = p->left ? p->left->total : 0;
+    size_t len = p->text.size();
+
+    if (bytes <= leftTotal) {
+        split(std::move(p->left), bytes, left, p->left);
+        update(p.get());
+        right = std::move(p);
+    }
+    else if (bytes >= leftTotal + len) {
+        split(std::move(p->right), bytes - leftTotal - len, p->right, right);
+        update(p.get());
+        left = std::move(p);
+    }
+    else {
+        //the cut falls inside this piece: its tail becomes a piece of its own
+        size_t cut = bytes - leftTotal;
+        Ptr tail = makePiece(p->text.substr(cut));
+        p->text.resize(cut);
+        right = merge(std::move(tail), std::move(p->right));
+        update(p.get());
+        left = std::move(p);
+    }
+}
+
+Rope::Ptr Rope::clone(const Piece* p) {
+    //each entry is a piece to copy and the slot its copy goes into
+    Ptr copy;
+    std::vector<std::pair<const Piece*, Ptr*>> stack;
+    if (p)
+        stack.emplace_back(p, &copy);
+    while (!stack.empty()) {
+        auto [from, to] = stack.back();
+        stack.pop_back();
+
+        *to = std::make_unique<Piece>();
+        Piece* piece = to->get();
+        piece->text = from->text;
+        piece->priority = from->priority;
+        piece->total = from->total;
+        piece->count = from->count;
+        if (from->left) stack.emplace_back(from->left.get(), &piece->left);
+        if (from->right) stack.emplace_back(from->right.get(), &piece->right);
+    }
+    return copy;
+}
+
+size_t Rope::size() const {
+    return root ? root->total : 0;
+}
+
+bool Rope::empty() const {
+    return size() == 0;
+}
+
+size_t Rope::pieceCount() const {
+    return root ? root->count : 0;
+}
+
+size_t Rope::depth() const {
+    size_t deepest = 0;
+    std::vector<std::pair<const Piece*, size_t>> stack;
+    if (root)
+        stack.emplace_back(root.get(), 1);
+    while (!stack.empty()) {
+        auto [p, d] = stack.back();
+        stack.pop_back();
+        deepest = std::max(deepest, d);
+        if (p->left) stack.emplace_back(p->left.get(), d + 1);
+        if (p->right) stack.emplace_back(p->right.get(), d + 1);
+    }
+    return deepest;
+}
+
+void Rope::clear() {
+    root.reset();
+}
+
+void Rope::assign(std::string text) {
+    root.reset();
+    if (!text.empty())
+        root = makePiece(std::move(text));
+}
+
+void Rope::append(std::string_view data) {
+    insert(size(), data);
+}
+
+void Rope::append(Rope&& other) {
+    //a lone short piece is folded in like any small write
+    if (other.pieceCount() <= 1) {
+        if (other.root)
+            append(other.root->text);
+    }
+    else {
+        root = merge(std::move(root), std::move(other.root));
+    }
+    other.clear();
+}
+
+void Rope::insert(size_t offset, std::string_view data) {
+    if (data.empty())
+        return;
+    offset = std::min(offset, size());
+
+    //find the piece the offset falls in (or ends at), remembering the path
+    //so the subtree sizes can be patched if the text fits in place
+    Piece* path[128];
+    size_t depth = 0;
+    Piece* p = root.get();
+    size_t at = offset;
+    while (p) {
+        if (depth == 128) {
+            p = nullptr; //far too deep to be a treap; take the general path
+            break;
+        }
+        path[depth++] = p;
+        size_t leftTotal = p->left ? p->left->total : 0;
+        if (at < leftTotal || (at == leftTotal && leftTotal > 0)) {
+            p = p->left.get();
+            continue;
+        }
+        at -= leftTotal;
+        if (at <= p->text.size())
+            break;
+        at -= p->text.size();
+        p = p->right.get();
+    }
+
+    if (p && p->text.size() + data.size() <= PIECE_BYTES) {
+        p->text.insert(at, data.data(), data.size());
+        for (size_t i = 0; i < depth; ++i)
+            path[i]->total += data.size();
+        return;
+    }
+
+    Ptr left, right;
+    split(std::move(root), offset, left, right);
+    root = merge(merge(std::move(left), build(data)), std::move(right));
+}
+
+void Rope::pieces(std::vector<std::string_view>& out) const {
+    forEachPiece([&](const char* data, size_t len) {
+        out.emplace_back(data, len);
+    });
+}
+
+std::string_view Rope::flatten() {
+    if (pieceCount() > 1)
+        assign(str());
+    return root ? std::string_view(root->text) : std::string_view();
+}
+
+std::string Rope::str() const {
+    std::string out;
+    out.reserve(size());
+    forEachPiece([&](const char* data, size_t len) {
+        out.append(data, len);
+    });
+    return out;
+}
+
+size_t Rope::heapBytes() const {
+    static const size_t inlineCapacity = std::string().capacity();
+    size_t bytes = 0;
+
+    std::vector<const Piece*> stack;
+    if (root)
+        stack.push_back(root.get());
+    while (!stack.empty()) {
+        const Piece* p = stack.back();
+        stack.pop_back();
+        bytes += sizeof(Piece);
+        if (p->text.capacity() > inlineCapacity)
+            bytes += p->text.capacity() + 1;
+        if (p->left) stack.push_back(p->left.get());
+        if (p->right) stack.push_back(p->right.get());
+    }
+    return bytes;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+//a file body kept as an implicit treap of text pieces ordered by position.
+//
+//append and insert split and re-merge the tree around the edit point
+//instead of moving every byte after it, so both cost O(log n) in the
+//number of pieces. small writes are folded into the neighbouring piece
+//while it stays under PIECE_BYTES, so a log grown line by line ends up as
+//a run of full pieces rather than one piece per line. readers walk the
+//pieces in order; nothing joins them unless flatten() is asked to
+class Rope {
+public:
+    static const size_t PIECE_BYTES = 4096;
+
+private:
+    struct Piece {
+        std::string text;
+        uint32_t priority;
+        size_t total;   //bytes in this subtree
+        size_t count;   //pieces in this subtree
+        std::unique_ptr<Piece> left;
+        std::unique_ptr<Piece> right;
+
+        ~Piece(); //iterative, so a lopsided tree cannot overflow the stack
+    };
+    using Ptr = std::unique_ptr<Piece>;
+
+    Ptr root;
+    uint32_t seed;
+
+    uint32_t nextRandom();
+    Ptr makePiece(std::string text);
+    Ptr build(std::string_view data);
+    static void update(Piece* p);
+    Ptr merge(Ptr a, Ptr b);
+    static Ptr clone(const Piece* p);
+    //the first `bytes` bytes go left; a piece straddling the cut is split
+    void split(Ptr p, size_t bytes, Ptr& left, Ptr& right);
+
+public:
+    Rope();
+    Rope(const Rope& other);
+    Rope(Rope&& other) noexcept;
+    Rope& operator=(const Rope& other);
+    Rope& operator=(Rope&& other) noexcept;
+
+    size_t size() const;
+    bool empty() const;
+    size_t pieceCount() const;
+    size_t depth() const; //pieces on the longest root-to-leaf path
+
+    void clear();
+    void assign(std::string text); //becomes a single piece, no copy
+    void append(std::string_view data);
+    void append(Rope&& other);
+    void insert(size_t offset, std::string_view data); //offset is clamped to size()
+
+    //calls sink(const char*, size_t) for every piece, in order
+    template <typename Sink>
+    void forEachPiece(Sink&& sink) const;
+
+    //views of the pieces, valid until the rope changes
+    void pieces(std::vector<std::string_view>& out) const;
+
+    //joins everything into one piece and returns it
+    std::string_view flatten();
+    std::string str() const;
+
+    //heap behind the pieces, tree nodes included
+    size_t heapBytes() const;
+};
+
+template <typename Sink>
+void Rope::forEachPiece(Sink&& sink) const {
+    //in-order walk with an explicit stack; the depth is O(log n)
+    std::vector<const Piece*> stack;
+    const Piece* p = root.get();
+    while (p || !stack.empty()) {
+        for (; p; p = p->left.get())
+            stack.push_back(p);
+        p = stack.back();
+        stack.pop_back();
+        if (!p->text.empty())
+            sink(p->text.data(), p->text.size());
+        p = p->right.get();
+    }
+}
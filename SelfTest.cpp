@@ -0,0 +1,249 @@
+#include "SelfTest.h"
+#include "VirtualFileSystem.h"
+#include "Shell.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <filesystem>
+#include <functional>
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char* SCRATCH = "vsh-selftest.txt";
+
+void removeScratch() {
+    std::error_code ec;
+    for (const char* suffix : { "", ".spill", ".journal" })
+        fs::remove(std::string(SCRATCH) + suffix, ec);
+}
+
+//a long session under a small budget: bodies keep being paged in, evicted
+//and rewritten. the spill file has to reuse the room they leave behind
+bool spillFileStaysBounded(std::string& detail) {
+    const size_t files = 40;
+    const size_t maxBody = 32 * 1024;
+
+    VirtualFileSystem vfs(SCRATCH);
+    vfs.cmdBudget(64 * 1024);
+
+    std::mt19937 rng(7);
+    auto body = [&](size_t i) {
+        return std::string(4096 + rng() % (maxBody - 4096), static_cast<char>('a' + i % 26));
+    };
+    for (size_t i = 0; i < files; ++i)
+        vfs.writeFile("/f" + std::to_string(i), body(i));
+
+    uint64_t peak = 0;
+    std::vector<std::string_view> pieces;
+    for (int round = 0; round < 5000; ++round) {
+        size_t i = rng() % files;
+        std::string path = "/f" + std::to_string(i);
+        if (rng() % 3 == 0) {
+            vfs.writeFile(path, body(i));
+        }
+        else {
+            pieces.clear();
+            vfs.readFile(path, pieces);
+        }
+
+        std::error_code ec;
+        uint64_t size = fs::file_size(std::string(SCRATCH) + ".spill", ec);
+        if (!ec && size > peak)
+            peak = size;
+    }
+
+    //everything spilled at once, with room for fragmentation
+    uint64_t bound = 2 * files * maxBody;
+    detail = "peak spill file " + std::to_string(peak) + " bytes, bound " + std::to_string(bound);
+    return peak > 0 && peak <= bound;
+}
+
+//a batch big enough to run on threads, naming one directory two ways. the
+//ops on it have to run in the order given, whichever spelling they use
+bool parallelBatchKeepsOrder(std::string& detail) {
+    VirtualFileSystem vfs(SCRATCH);
+    vfs.makeDirectory("/d");
+    vfs.makeDirectory("/e");
+    vfs.createFile("/d/first");
+
+    std::vector<TxOp> ops;
+    ops.push_back({ TxOp::Kind::Chmod, "/d/./first", "r--", false });
+    const size_t files = 2500;
+    for (size_t i = 0; i < files; ++i) {
+        std::string name = "f" + std::to_string(i);
+        ops.push_back({ TxOp::Kind::Touch, "/d/" + name, "", false });
+        ops.push_back({ TxOp::Kind::Chmod, "/d/./" + name, "r--", false });
+        ops.push_back({ TxOp::Kind::Touch, "/e/" + name, "", false });
+    }
+
+    std::vector<VfsStatus> results;
+    vfs.applyBatch(ops, results);
+
+    size_t failed = 0;
+    for (VfsStatus st : results) {
+        if (st != VfsStatus::Ok)
+            ++failed;
+    }
+    size_t wrongMode = 0;
+    for (size_t i = 0; i < files; ++i) {
+        const VFSNode* node = nullptr;
+        if (vfs.lookup("/d/f" + std::to_string(i), node) != VfsStatus::Ok || node->getPermissions() != "r--")
+            ++wrongMode;
+    }
+
+    detail = std::to_string(ops.size()) + " ops, " + std::to_string(failed) + " failed, "
+        + std::to_string(wrongMode) + " with the wrong mode";
+    return failed == 0 && wrongMode == 0;
+}
+
+//appends that each add more than one piece used to stack the pieces into
+//a chain: every append was linear and a long enough log overflowed the
+//stack. the tree has to stay logarithmic
+bool largeAppendsStayShallow(std::string& detail) {
+    const size_t appends = 20000;
+
+    VirtualFileSystem vfs(SCRATCH);
+    std::string chunk(Rope::PIECE_BYTES + 1, 'a');
+    for (size_t i = 0; i < appends; ++i)
+        vfs.writeFile("/log", std::vector<std::string_view>{ chunk }, true);
+
+    const VFSNode* node = nullptr;
+    if (vfs.lookup("/log", node) != VfsStatus::Ok) {
+        detail = "/log missing";
+        return false;
+    }
+    const Rope& body = node->getContentConst();
+    size_t bound = 4 * static_cast<size_t>(std::log2(static_cast<double>(body.pieceCount())) + 1);
+    detail = std::to_string(body.pieceCount()) + " pieces, depth " + std::to_string(body.depth())
+        + ", bound " + std::to_string(bound);
+    return body.size() == appends * chunk.size() && body.depth() <= bound;
+}
+
+//a torn write at the end of the journal, then more commits after a
+//restart. those land behind the damage and have to replay too
+bool tornJournalTailIsCut(std::string& detail) {
+    std::ostringstream console;
+    auto commit = [&](const std::string& dir) {
+        VirtualFileSystem vfs(SCRATCH);
+        vfs.setConsole(console);
+        vfs.load();
+        size_t failedOp = 0;
+        return vfs.commitTransaction({ { TxOp::Kind::Mkdir, dir, "", false } }, failedOp);
+    };
+
+    if (commit("/j1") != VfsStatus::Ok) {
+        detail = "first commit failed";
+        return false;
+    }
+    {
+        std::ofstream journal(std::string(SCRATCH) + ".journal", std::ios::binary | std::ios::app);
+        journal << "VTXJ half a record";
+    }
+    if (commit("/j2") != VfsStatus::Ok) {
+        detail = "second commit failed";
+        return false;
+    }
+
+    VirtualFileSystem vfs(SCRATCH);
+    vfs.setConsole(console);
+    vfs.load();
+    const VFSNode* node = nullptr;
+    bool first = vfs.lookup("/j1", node) == VfsStatus::Ok;
+    bool second = vfs.lookup("/j2", node) == VfsStatus::Ok;
+    if (!first || !second)
+        detail = std::string(first ? "" : "/j1 missing; ") + (second ? "" : "/j2 missing; ")
+            + "console said: " + console.str();
+    return first && second;
+}
+
+//a transaction that builds on a change made outside any transaction. the
+//journal alone cannot bring that change back, so the commit has to
+bool commitAfterUnjournaledChange(std::string& detail) {
+    std::ostringstream console;
+    {
+        VirtualFileSystem vfs(SCRATCH);
+        vfs.setConsole(console);
+        vfs.load();
+        vfs.makeDirectory("/a");
+        size_t failedOp = 0;
+        if (vfs.commitTransaction({ { TxOp::Kind::Touch, "/a/f", "", false } }, failedOp) != VfsStatus::Ok) {
+            detail = "commit failed";
+            return false;
+        }
+    }
+
+    VirtualFileSystem vfs(SCRATCH);
+    vfs.setConsole(console);
+    vfs.load();
+    const VFSNode* node = nullptr;
+    bool found = vfs.lookup("/a/f", node) == VfsStatus::Ok;
+    if (!found)
+        detail = "/a/f missing; console said: " + console.str();
+    return found;
+}
+
+//cp with a pattern that matches one file, into an existing directory,
+//outside and inside a transaction
+bool cpGlobIntoDirectory(std::string& detail) {
+    VirtualFileSystem vfs(SCRATCH);
+    vfs.makeDirectory("/d");
+    vfs.makeDirectory("/t");
+    vfs.createFile("/x.log");
+
+    std::istringstream input;
+    std::ostringstream output;
+    Shell shell(vfs, input, output);
+    shell.execute("cp /*.log /d");
+    shell.execute("begin");
+    shell.execute("cp /*.log /t");
+    shell.execute("commit");
+
+    const VFSNode* node = nullptr;
+    bool copied = vfs.lookup("/d/x.log", node) == VfsStatus::Ok;
+    bool staged = vfs.lookup("/t/x.log", node) == VfsStatus::Ok;
+    if (!copied || !staged)
+        detail = std::string(copied ? "" : "/d/x.log missing; ") + (staged ? "" : "/t/x.log missing; ")
+            + "shell said: " + output.str();
+    return copied && staged;
+}
+
+}
+
+int runSelfTests() {
+    struct Check {
+        const char* name;
+        std::function<bool(std::string&)> run;
+    };
+    std::vector<Check> checks = {
+        { "spill file stays bounded", spillFileStaysBounded },
+        { "parallel batch keeps op order", parallelBatchKeepsOrder },
+        { "large appends keep the rope shallow", largeAppendsStayShallow },
+        { "commits after a torn journal tail replay", tornJournalTailIsCut },
+        { "commit after an unjournaled change replays", commitAfterUnjournaledChange },
+        { "cp of one match into a directory", cpGlobIntoDirectory },
+    };
+
+    int failed = 0;
+    for (const Check& check : checks) {
+        removeScratch();
+        std::string detail;
+        bool ok = check.run(detail);
+        removeScratch();
+
+        std::cout << (ok ? "ok    " : "FAIL  ") << check.name;
+        if (!detail.empty())
+            std::cout << " (" << detail << ")";
+        std::cout << "\n";
+        if (!ok) ++failed;
+    }
+
+    std::cout << (checks.size() - failed) << "/" << checks.size() << " checks passed\n";
+    return failed == 0 ? 0 : 1;
+}
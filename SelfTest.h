@@ -0,0 +1,7 @@
+#pragma once
+
+//regression checks for behaviour that only shows up under load or over a
+//long session (spill file growth, parallel batches). each check runs
+//against a scratch save file in the working directory. prints one line
+//per check and returns a process exit code
+int runSelfTests();
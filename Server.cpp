@@ -0,0 +1,596 @@
+#include "Server.h"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+
+std::string joinPath(const std::string& cwd, std::string_view path) {
+    if (!path.empty() && path[0] == '/')
+        return std::string(path);
+    std::string full = cwd;
+    if (full.empty() || full.back() != '/')
+        full += '/';
+    full.append(path.data(), path.size());
+    return full;
+}
+
+bool isReadRequest(ProtoOp op) {
+    return op == ProtoOp::Pwd || op == ProtoOp::Ls || op == ProtoOp::Cd
+        || op == ProtoOp::Cat || op == ProtoOp::Tree;
+}
+
+VfsStatus runReadRequest(const VirtualFileSystem& vfs, const ProtoRequest& req,
+    std::string& cwd, std::string& payload) {
+    auto arg = [&](size_t i) -> std::string {
+        return i < req.args.size() ? joinPath(cwd, req.args[i]) : cwd;
+    };
+    VfsStatus st = VfsStatus::InvalidArgument;
+
+    switch (req.op) {
+    case ProtoOp::Pwd:
+        payload = cwd;
+        st = VfsStatus::Ok;
+        break;
+
+    case ProtoOp::Ls:
+        st = vfs.visitDirectory(arg(0), [&](const VFSNode& child) {
+            appendListEntry(payload, child.isDirectory(), child.getPermissions(), child.getName());
+        });
+        break;
+
+    case ProtoOp::Cd: {
+        //same checks as VirtualFileSystem::changeDirectory, against the session cwd
+        const VFSNode* node = nullptr;
+        st = vfs.lookup(arg(0), node);
+        if (st != VfsStatus::Ok) break;
+        if (!node->isDirectory())
+            st = VfsStatus::NotADirectory;
+        else if (node->getPermissions().find('x') == std::string::npos)
+            st = VfsStatus::PermissionDenied;
+        else
+            cwd = vfs.pathOf(node);
+        break;
+    }
+
+    case ProtoOp::Cat:
+        //straight from the store, so concurrent readers never page bodies in
+        if (!req.args.empty()) {
+            st = vfs.streamFile(arg(0), [&](const char* data, size_t len) {
+                payload.append(data, len);
+            });
+        }
+        break;
+
+    case ProtoOp::Tree: {
+        std::ostringstream out;
+        vfs.cmdTree(out);
+        payload = out.str();
+        st = VfsStatus::Ok;
+        break;
+    }
+
+    default:
+        break;
+    }
+    return st;
+}
+
+}
+
+bool executeReadRequest(const VirtualFileSystem& vfs, const ProtoRequest& req,
+    std::string& cwd, std::string& payload, uint8_t& status) {
+    if (!isReadRequest(req.op))
+        return false;
+    if (req.op != ProtoOp::Pwd && req.op != ProtoOp::Tree
+        && vfs.needsLoad(req.args.empty() ? cwd : joinPath(cwd, req.args[0])))
+        return false;
+
+    status = static_cast<uint8_t>(runReadRequest(vfs, req, cwd, payload));
+    return true;
+}
+
+uint8_t executeRequest(VirtualFileSystem& vfs, const ProtoRequest& req,
+    std::string& cwd, std::string& payload, uint64_t& ticket, bool& journaled) {
+    journaled = false;
+    if (isReadRequest(req.op))
+        return static_cast<uint8_t>(runReadRequest(vfs, req, cwd, payload));
+
+    if (req.op == ProtoOp::Save) {
+        vfs.save();
+        return static_cast<uint8_t>(VfsStatus::Ok);
+    }
+
+    auto arg = [&](size_t i) { return joinPath(cwd, req.args[i]); };
+    auto need = [&](size_t n) { return req.args.size() >= n; };
+
+    TxOp op{ TxOp::Kind::Mkdir, "", "", false };
+    switch (req.op) {
+    case ProtoOp::Mkdir:
+        if (!need(1)) break;
+        op = TxOp{ TxOp::Kind::Mkdir, arg(0), "", false };
+        break;
+
+    case ProtoOp::Touch:
+        if (!need(1)) break;
+        op = TxOp{ TxOp::Kind::Touch, arg(0), "", false };
+        break;
+
+    case ProtoOp::Rm:
+        if (!need(1)) break;
+        op = TxOp{ TxOp::Kind::Rm, arg(0), "", (req.flags & PROTO_FLAG_RECURSIVE) != 0 };
+        break;
+
+    case ProtoOp::Write:
+        if (!need(2)) break;
+        op = TxOp{ TxOp::Kind::Write, arg(0), std::string(req.args[1]), false };
+        break;
+
+    case ProtoOp::Cp:
+        if (!need(2)) break;
+        op = TxOp{ TxOp::Kind::Copy, arg(0), arg(1), false };
+        break;
+
+    case ProtoOp::Mv:
+        if (!need(2)) break;
+        op = TxOp{ TxOp::Kind::Move, arg(0), arg(1), false };
+        break;
+
+    case ProtoOp::Chmod:
+        if (!need(2)) break;
+        op = TxOp{ TxOp::Kind::Chmod, arg(1), std::string(req.args[0]), false };
+        break;
+
+    default:
+        break;
+    }
+    if (op.path.empty())
+        return static_cast<uint8_t>(VfsStatus::InvalidArgument);
+
+    //every change is journaled so a crash before the next save loses nothing
+    size_t failedOp = 0;
+    VfsStatus st = vfs.applyTransaction(std::vector<TxOp>{ std::move(op) }, ticket, failedOp);
+    journaled = st == VfsStatus::Ok;
+    return static_cast<uint8_t>(st);
+}
+
+#ifdef __linux__
+
+namespace {
+
+std::atomic<bool> signalled{ false };
+
+void onSignal(int) {
+    signalled = true;
+}
+
+const uint64_t LISTEN_ID = 0;
+const uint64_t WAKE_ID = 1;
+
+}
+
+struct VfsServer::State {
+    struct Conn {
+        int fd;
+        std::string in;
+        size_t inPos;       //start of the first frame not yet dispatched
+        std::string out;
+        size_t outPos;
+        std::string cwd;
+        bool busy;          //one request in flight keeps replies in order
+        bool wantWrite;
+        bool hungUp;        //peer is gone; close once the request in flight is back
+        uint32_t events;    //interest currently registered with epoll
+    };
+
+    struct Task {
+        uint64_t id;
+        std::string frame;
+        std::string cwd;
+    };
+
+    struct Done {
+        uint64_t id;
+        std::string response;
+        std::string cwd;
+    };
+
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+
+    //shared by read-only requests, exclusive for everything else
+    std::shared_mutex vfsMutex;
+
+    std::mutex taskMutex;
+    std::condition_variable taskCv;
+    std::deque<Task> tasks;
+    bool stopping = false;
+
+    std::mutex doneMutex;
+    std::vector<Done> done;
+
+    //owned by the event loop thread only
+    std::unordered_map<uint64_t, Conn> conns;
+    uint64_t nextId = 2;
+
+    std::atomic<bool> stopRequested{ false };
+};
+
+VfsServer::VfsServer(VirtualFileSystem& vfsRef, const std::string& path, unsigned workers)
+    : vfs(vfsRef), socketPath(path), workerCount(workers ? workers : 2), state(new State) {
+}
+
+VfsServer::~VfsServer() {
+    if (state->listenFd >= 0) {
+        close(state->listenFd);
+        unlink(socketPath.c_str());
+    }
+    if (state->epollFd >= 0) close(state->epollFd);
+    if (state->wakeFd >= 0) close(state->wakeFd);
+    for (auto& kv : state->conns)
+        close(kv.second.fd);
+}
+
+void VfsServer::stop() {
+    state->stopRequested = true;
+    uint64_t one = 1;
+    if (state->wakeFd >= 0 && write(state->wakeFd, &one, sizeof(one)) < 0) {
+        //the loop also polls the flag on its timeout
+    }
+}
+
+void VfsServer::workerLoop() {
+    State& s = *state;
+
+    while (true) {
+        State::Task task;
+        {
+            std::unique_lock<std::mutex> lock(s.taskMutex);
+            s.taskCv.wait(lock, [&] { return s.stopping || !s.tasks.empty(); });
+            if (s.tasks.empty()) return;
+            task = std::move(s.tasks.front());
+            s.tasks.pop_front();
+        }
+
+        ProtoRequest req;
+        std::string payload;
+        uint8_t status = static_cast<uint8_t>(VfsStatus::InvalidArgument);
+
+        if (decodeRequest(task.frame, req)) {
+            bool done;
+            {
+                std::shared_lock<std::shared_mutex> lock(s.vfsMutex);
+                done = executeReadRequest(vfs, req, task.cwd, payload, status);
+            }
+
+            if (!done) {
+                uint64_t ticket = 0;
+                bool journaled = false;
+                {
+                    std::unique_lock<std::shared_mutex> lock(s.vfsMutex);
+                    status = executeRequest(vfs, req, task.cwd, payload, ticket, journaled);
+                }
+                //outside the lock, so commits from other workers join the same sync
+                if (journaled && vfs.waitDurable(ticket) != VfsStatus::Ok)
+                    status = static_cast<uint8_t>(VfsStatus::IoError);
+            }
+        }
+
+        State::Done result;
+        result.id = task.id;
+        result.cwd = std::move(task.cwd);
+        encodeResponse(result.response, status, payload);
+
+        {
+            std::lock_guard<std::mutex> lock(s.doneMutex);
+            s.done.push_back(std::move(result));
+        }
+        uint64_t one = 1;
+        if (write(s.wakeFd, &one, sizeof(one)) < 0) {
+            //eventfd only fails if the counter overflows; the loop drains it anyway
+        }
+    }
+}
+
+bool VfsServer::eventLoop() {
+    State& s = *state;
+
+    auto closeConn = [&](uint64_t id) {
+        auto it = s.conns.find(id);
+        if (it == s.conns.end()) return;
+        if (!it->second.hungUp)
+            epoll_ctl(s.epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        s.conns.erase(it);
+    };
+
+    //while a request is in flight nothing more is read, so a client that
+    //keeps sending without reading replies is held back by its socket
+    //buffer, and a half-closed peer does not wake the loop over and over.
+    //returns false if epoll refused the change
+    auto updateInterest = [&](uint64_t id, State::Conn& c) {
+        uint32_t want = c.busy ? 0u : uint32_t(EPOLLIN | EPOLLRDHUP);
+        if (c.wantWrite)
+            want |= EPOLLOUT;
+        if (c.hungUp || want == c.events)
+            return true;
+
+        epoll_event ev{};
+        ev.events = want;
+        ev.data.u64 = id;
+        if (epoll_ctl(s.epollFd, EPOLL_CTL_MOD, c.fd, &ev) < 0)
+            return false;
+        c.events = want;
+        return true;
+    };
+
+    //returns false if the connection died
+    auto flush = [&](State::Conn& c) {
+        while (c.outPos < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+            if (n > 0) {
+                c.outPos += static_cast<size_t>(n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                c.wantWrite = true;
+                return true;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        c.out.clear();
+        c.outPos = 0;
+        c.wantWrite = false;
+        return true;
+    };
+
+    auto dispatch = [&](uint64_t id, State::Conn& c) {
+        if (c.busy) return true;
+        size_t len = frameLength(std::string_view(c.in).substr(c.inPos));
+        if (len == SIZE_MAX) return false;
+        if (len == 0) return true;
+
+        State::Task task{ id, c.in.substr(c.inPos, len), c.cwd };
+        c.inPos += len;
+        if (c.inPos == c.in.size()) {
+            c.in.clear();
+            c.inPos = 0;
+        }
+        c.busy = true;
+        {
+            std::lock_guard<std::mutex> lock(s.taskMutex);
+            s.tasks.push_back(std::move(task));
+        }
+        s.taskCv.notify_one();
+        return true;
+    };
+
+    std::vector<epoll_event> events(256);
+    char buffer[64 * 1024];
+
+    while (!s.stopRequested && !signalled) {
+        int n = epoll_wait(s.epollFd, events.data(), static_cast<int>(events.size()), 250);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cout << "server: epoll_wait failed: " << std::strerror(errno) << "\n";
+            return false;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            uint64_t id = events[i].data.u64;
+            uint32_t ev = events[i].events;
+
+            if (id == LISTEN_ID) {
+                while (true) {
+                    int fd = accept4(s.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) break;
+
+                    epoll_event cev{};
+                    cev.events = EPOLLIN | EPOLLRDHUP;
+                    cev.data.u64 = s.nextId;
+                    if (epoll_ctl(s.epollFd, EPOLL_CTL_ADD, fd, &cev) < 0) {
+                        close(fd);
+                        continue;
+                    }
+                    s.conns[s.nextId++] = State::Conn{ fd, "", 0, "", 0, "/", false, false, false, cev.events };
+                }
+                continue;
+            }
+
+            if (id == WAKE_ID) {
+                uint64_t count;
+                if (read(s.wakeFd, &count, sizeof(count)) < 0) {
+                    //spurious wakeup; nothing to drain
+                }
+
+                std::vector<State::Done> finished;
+                {
+                    std::lock_guard<std::mutex> lock(s.doneMutex);
+                    finished.swap(s.done);
+                }
+                for (auto& d : finished) {
+                    auto it = s.conns.find(d.id);
+                    if (it == s.conns.end()) continue; //client went away meanwhile
+
+                    State::Conn& c = it->second;
+                    c.busy = false;
+                    if (c.hungUp) {
+                        closeConn(d.id);
+                        continue;
+                    }
+                    c.cwd = std::move(d.cwd);
+                    c.out += d.response;
+                    if (!flush(c) || !dispatch(d.id, c) || !updateInterest(d.id, c))
+                        closeConn(d.id);
+                }
+                continue;
+            }
+
+            auto it = s.conns.find(id);
+            if (it == s.conns.end()) continue;
+            State::Conn& c = it->second;
+
+            if ((ev & EPOLLIN) && !c.busy) {
+                //drop what was dispatched before growing the buffer again
+                if (c.inPos > 0) {
+                    c.in.erase(0, c.inPos);
+                    c.inPos = 0;
+                }
+
+                bool alive = true;
+                while (true) {
+                    ssize_t got = recv(c.fd, buffer, sizeof(buffer), 0);
+                    if (got > 0) {
+                        c.in.append(buffer, static_cast<size_t>(got));
+                        //one whole frame is enough to get going; the rest can wait in the socket
+                        if (frameLength(c.in) != 0)
+                            break;
+                        continue;
+                    }
+                    if (got < 0 && errno == EINTR)
+                        continue;
+                    if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                        alive = false;
+                    break;
+                }
+                //a peer that hung up still gets answers to what it already sent
+                if (!dispatch(id, c) || (!alive && !c.busy)) {
+                    closeConn(id);
+                    continue;
+                }
+            }
+
+            if ((ev & EPOLLOUT) && !flush(c)) {
+                closeConn(id);
+                continue;
+            }
+
+            if (ev & (EPOLLERR | EPOLLHUP)) {
+                if (!c.busy) {
+                    closeConn(id);
+                    continue;
+                }
+                //hangups are reported whatever the interest set; stop
+                //watching and finish the connection when its request returns
+                epoll_ctl(s.epollFd, EPOLL_CTL_DEL, c.fd, nullptr);
+                c.hungUp = true;
+                continue;
+            }
+
+            if (!updateInterest(id, c))
+                closeConn(id);
+        }
+    }
+    return true;
+}
+
+bool VfsServer::run() {
+    State& s = *state;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        std::cout << "server: socket path too long\n";
+        return false;
+    }
+    std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    s.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socketPath.c_str());
+    if (s.listenFd < 0
+        || bind(s.listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+        || listen(s.listenFd, SOMAXCONN) < 0) {
+        std::cout << "server: cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    s.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    s.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s.epollFd < 0 || s.wakeFd < 0) {
+        std::cout << "server: cannot create event loop\n";
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTEN_ID;
+    bool added = epoll_ctl(s.epollFd, EPOLL_CTL_ADD, s.listenFd, &ev) == 0;
+    ev.data.u64 = WAKE_ID;
+    if (!added || epoll_ctl(s.epollFd, EPOLL_CTL_ADD, s.wakeFd, &ev) < 0) {
+        std::cout << "server: cannot watch sockets: " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < workerCount; ++i)
+        pool.emplace_back(&VfsServer::workerLoop, this);
+
+    std::cout << "Serving on " << socketPath << " with " << workerCount << " workers. Ctrl+C to stop.\n";
+    bool ok = eventLoop();
+
+    {
+        std::lock_guard<std::mutex> lock(s.taskMutex);
+        s.stopping = true;
+    }
+    s.taskCv.notify_all();
+    for (auto& t : pool)
+        t.join();
+
+    return ok;
+}
+
+#else
+
+struct VfsServer::State {
+};
+
+VfsServer::VfsServer(VirtualFileSystem& vfsRef, const std::string& path, unsigned workers)
+    : vfs(vfsRef), socketPath(path), workerCount(workers), state(new State) {
+}
+
+VfsServer::~VfsServer() {
+}
+
+void VfsServer::workerLoop() {
+}
+
+bool VfsServer::eventLoop() {
+    return false;
+}
+
+bool VfsServer::run() {
+    std::cout << "server: socket server mode needs Linux (epoll)\n";
+    return false;
+}
+
+void VfsServer::stop() {
+}
+
+#endif
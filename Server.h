@@ -0,0 +1,44 @@
+#pragma once
+
+#include "VirtualFileSystem.h"
+#include "Protocol.h"
+#include <string>
+#include <memory>
+
+//serves one VirtualFileSystem to many clients over a unix domain socket.
+//a single epoll thread owns every connection and a small worker pool runs
+//the requests; each connection keeps its own working directory.
+//only available on linux; elsewhere run() reports that and returns false
+class VfsServer {
+private:
+    struct State;
+
+    VirtualFileSystem& vfs;
+    std::string socketPath;
+    unsigned workerCount;
+    std::unique_ptr<State> state;
+
+    void workerLoop();
+    bool eventLoop();
+
+public:
+    VfsServer(VirtualFileSystem& vfs, const std::string& socketPath, unsigned workers);
+    ~VfsServer();
+
+    //blocks until stop() or SIGINT/SIGTERM
+    bool run();
+    void stop();
+};
+
+//runs a request against the VFS for a session whose working directory is
+//`cwd`; the caller holds the VFS exclusively. changes are applied as a
+//one-op transaction: `journaled` says whether one was, and the caller waits
+//on `ticket` with vfs.waitDurable after letting go of the VFS
+uint8_t executeRequest(VirtualFileSystem& vfs, const ProtoRequest& req,
+    std::string& cwd, std::string& payload, uint64_t& ticket, bool& journaled);
+
+//the read-only requests (pwd, ls, cd, cat, tree), for callers that only
+//hold the VFS shared. returns false without doing anything when req is not
+//one of them or would have to read a volume in
+bool executeReadRequest(const VirtualFileSystem& vfs, const ProtoRequest& req,
+    std::string& cwd, std::string& payload, uint8_t& status);
@@ -1,11 +1,18 @@
 #include "Shell.h"
+#include "Pipeline.h"
 
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <cstdint>
 
-Shell::Shell(VirtualFileSystem& vfsRef)
-    : vfs(vfsRef), running(true) {
+Shell::Shell(VirtualFileSystem& vfsRef, std::istream& input, std::ostream& output)
+    : vfs(vfsRef), in(input), out(output), running(true), inTransaction(false) {
+    vfs.setConsole(out);
+}
+
+Shell::~Shell() {
+    stopTrace();
 }
 
 void Shell::addToHistory(const std::string& line) {
@@ -15,7 +22,111 @@ void Shell::addToHistory(const std::string& line) {
 }
 
 void Shell::printPrompt() const {
-    std::cout << "vsh:" << vfs.getCurrentPath() << "$ ";
+    out << "vsh:" << vfs.getCurrentPath() << (inTransaction ? " [tx]" : "") << "$ ";
+}
+
+std::vector<std::string> Shell::expandArgs(std::stringstream& ss) const {
+    std::vector<std::string> args;
+    std::string word;
+    while (ss >> word) {
+        //a pattern that matches nothing is passed on as typed
+        if (!hasGlobChars(word) || vfs.expandGlob(word, args) != VfsStatus::Ok)
+            args.push_back(word);
+    }
+    return args;
+}
+
+bool Shell::isDirectory(const std::string& path) const {
+    const VFSNode* node = nullptr;
+    return vfs.lookup(path, node) == VfsStatus::Ok && node->isDirectory();
+}
+
+std::vector<TxOp> Shell::batchOps(TxOp::Kind kind, const std::vector<std::string>& paths,
+    const std::string& arg, bool recursive) const {
+    std::vector<TxOp> ops;
+    ops.reserve(paths.size());
+    for (const std::string& path : paths)
+        ops.push_back(TxOp{ kind, path, arg, recursive });
+    return ops;
+}
+
+bool Shell::stageCommand(const std::string& cmd, std::stringstream& ss) {
+    TxOp op;
+    op.recursive = false;
+    std::vector<std::string> paths;
+
+    if (cmd == "mkdir" || cmd == "touch") {
+        paths = expandArgs(ss);
+        op.kind = cmd == "mkdir" ? TxOp::Kind::Mkdir : TxOp::Kind::Touch;
+    }
+    else if (cmd == "write") {
+        ss >> op.path;
+        op.kind = TxOp::Kind::Write;
+        if (!op.path.empty()) {
+            op.arg = readTextBlock(in, out);
+            paths.push_back(op.path);
+        }
+    }
+    else if (cmd == "chmod") {
+        ss >> op.arg;
+        paths = expandArgs(ss);
+        op.kind = TxOp::Kind::Chmod;
+    }
+    else if (cmd == "rm") {
+        paths = expandArgs(ss);
+        if (!paths.empty() && paths[0] == "-r") {
+            op.recursive = true;
+            paths.erase(paths.begin());
+        }
+        op.kind = TxOp::Kind::Rm;
+    }
+    else if (cmd == "cp" || cmd == "mv") {
+        //one op per source; several cp sources go into the last argument
+        std::vector<std::string> args;
+        if (cmd == "cp") {
+            args = expandArgs(ss);
+        }
+        else {
+            std::string src, dst;
+            if (ss >> src >> dst)
+                args = { src, dst };
+        }
+        if (args.size() < 2) {
+            out << cmd << ": missing operand\n";
+            return true;
+        }
+
+        op.kind = cmd == "cp" ? TxOp::Kind::Copy : TxOp::Kind::Move;
+        std::string dst = args.back();
+        args.pop_back();
+        bool into = cmd == "cp" && (args.size() > 1 || isDirectory(dst));
+        for (const std::string& src : args) {
+            op.path = vfs.absolutePath(src);
+            op.arg = vfs.absolutePath(into ? VirtualFileSystem::copyTarget(src, dst) : dst);
+            staged.push_back(op);
+        }
+        return true;
+    }
+    else if (cmd == "append" || cmd == "insert") {
+        //edits in place have no staged form
+        out << cmd << ": not available inside a transaction\n";
+        return true;
+    }
+    else {
+        return false;
+    }
+
+    if (paths.empty()) {
+        out << cmd << ": missing operand\n";
+        return true;
+    }
+
+    //paths are pinned now so a later cd does not change what commits
+    for (const std::string& path : paths) {
+        op.path = vfs.absolutePath(path);
+        staged.push_back(op);
+    }
+    return true;
 }
 
 void Shell::handleCommand(const std::string& line) {
@@ -27,42 +138,98 @@ void Shell::handleCommand(const std::string& line) {
         return;
     }
 
+    if (Pipeline::isPipeline(line)) {
+        if (inTransaction && line.find('>') != std::string::npos) {
+            out << "pipe: redirection is not available inside a transaction\n";
+            return;
+        }
+        Pipeline(vfs, out).run(line);
+        return;
+    }
+
+    if (inTransaction && stageCommand(cmd, ss)) {
+        return;
+    }
+
     if (cmd == "exit" || cmd == "quit") {
+        if (inTransaction) {
+            out << "Open transaction discarded (" << staged.size() << " operations).\n";
+            inTransaction = false;
+            staged.clear();
+        }
         running = false;
         vfs.save();
-        std::cout << "Exiting shell. Virtual file system saved.\n";
+        out << "Exiting shell. Virtual file system saved.\n";
         return;
     }
 
     if (cmd == "help") {
-        std::cout << "Available commands:\n";
-        std::cout << "  pwd                 - print current path\n";
-        std::cout << "  ls                  - list directory contents\n";
-        std::cout << "  cd <path>           - change directory\n";
-        std::cout << "  mkdir <path>        - create directory\n";
-        std::cout << "  touch <path>        - create file\n";
-        std::cout << "  cat <path>          - show file contents\n";
-        std::cout << "  write <path>        - edit file (type .end to finish)\n";
-        std::cout << "  rm <path>           - remove file or empty directory\n";
-        std::cout << "  rm -r <path>        - remove directory tree\n";
-        std::cout << "  cp <src> <dst>      - copy file or directory\n";
-        std::cout << "  mv <src> <dst>      - move or rename\n";
-        std::cout << "  chmod <perms> <p>   - set permissions (e.g. rw-, r--, rwx)\n";
-        std::cout << "  tree                - show directory tree\n";
-        std::cout << "  history             - show typed commands\n";
-        std::cout << "  save                - save virtual file system to disk\n";
-        std::cout << "  help                - show this help\n";
-        std::cout << "  exit / quit         - leave shell\n";
+        out << "Available commands:\n";
+        out << "  pwd                 - print current path\n";
+        out << "  ls                  - list directory contents\n";
+        out << "  ls -p <n> [after]   - list n entries by name, after a cursor\n";
+        out << "  cd <path>           - change directory\n";
+        out << "  mkdir <path>...     - create directories\n";
+        out << "  touch <path>...     - create files\n";
+        out << "  cat <path>          - show file contents\n";
+        out << "  write <path>        - edit file (type .end to finish)\n";
+        out << "  append <path> [txt] - add a line, or a block, to the end of a file\n";
+        out << "  insert <p> <n> [t]  - insert a line, or a block, at byte offset n\n";
+        out << "  rm <path>...        - remove files or empty directories\n";
+        out << "  rm -r <path>...     - remove directory trees\n";
+        out << "  cp <src> <dst>      - copy file or directory\n";
+        out << "  cp <src>... <dir>   - copy several into a directory\n";
+        out << "  mv <src> <dst>      - move or rename\n";
+        out << "  chmod <mode> <p>... - set permissions (e.g. rw-, r--, rwx)\n";
+        out << "  tree                - show directory tree\n";
+        out << "  mount [file] [dir]  - attach a snapshot file on an empty dir (no args: list)\n";
+        out << "  unmount <dir>       - save and detach a mounted volume\n";
+        out << "  import <host> <dir> - copy a host directory tree into dir\n";
+        out << "  export <dir> <host> - copy dir out to a host directory\n";
+        out << "  tar -c <file> <dir> - write dir to a tar archive\n";
+        out << "  tar -x <file> <dir> - extract a tar archive into dir\n";
+        out << "  history             - show typed commands\n";
+        out << "  a | b, > f, >> f    - pipe cat/echo/ls/pwd/tree into grep [-v]/head/tail/wc\n";
+        out << "  begin               - start staging mkdir/touch/write/chmod/rm/cp/mv\n";
+        out << "  commit              - apply all staged commands, or none\n";
+        out << "  abort               - drop all staged commands\n";
+        out << "  watch [path]        - report changes under path (no path: list watches)\n";
+        out << "  unwatch <path>      - stop watching path\n";
+        out << "  events              - show changes seen by the watches\n";
+        out << "  trace start <file>  - record every command to a binary trace\n";
+        out << "  trace stop          - finish the trace\n";
+        out << "  budget <bytes>      - cap resident file content (0 = no cap)\n";
+        out << "  stats               - show content memory statistics\n";
+        out << "  mem [path]          - show memory use by category for a subtree\n";
+        out << "  save                - save virtual file system to disk\n";
+        out << "  help                - show this help\n";
+        out << "  exit / quit         - leave shell\n";
+        out << "mkdir/touch/rm/cp/chmod paths may use * ? [a-z] and ** (any depth)\n";
         return;
     }
 
     if (cmd == "pwd") {
-        vfs.cmdPwd();
+        vfs.cmdPwd(out);
         return;
     }
 
     if (cmd == "ls") {
-        vfs.cmdLs();
+        std::string flag;
+        ss >> flag;
+
+        if (flag == "-p") {
+            size_t count = 0;
+            std::string cursor;
+            if (!(ss >> count)) {
+                out << "ls: missing page size\n";
+                return;
+            }
+            ss >> cursor;
+            vfs.cmdLsPage(cursor, count);
+            return;
+        }
+
+        vfs.cmdLs(out);
         return;
     }
 
@@ -74,16 +241,20 @@ void Shell::handleCommand(const std::string& line) {
     }
 
     if (cmd == "mkdir") {
-        std::string path;
-        ss >> path;
-        vfs.cmdMkdir(path);
+        std::vector<std::string> paths = expandArgs(ss);
+        if (paths.size() <= 1)
+            vfs.cmdMkdir(paths.empty() ? "" : paths[0]);
+        else
+            vfs.cmdBatch("mkdir", batchOps(TxOp::Kind::Mkdir, paths, "", false));
         return;
     }
 
     if (cmd == "touch") {
-        std::string path;
-        ss >> path;
-        vfs.cmdTouch(path);
+        std::vector<std::string> paths = expandArgs(ss);
+        if (paths.size() <= 1)
+            vfs.cmdTouch(paths.empty() ? "" : paths[0]);
+        else
+            vfs.cmdBatch("touch", batchOps(TxOp::Kind::Touch, paths, "", false));
         return;
     }
 
@@ -97,32 +268,59 @@ void Shell::handleCommand(const std::string& line) {
     if (cmd == "write") {
         std::string path;
         ss >> path;
-        vfs.cmdWrite(path);
+        vfs.cmdWrite(path, in);
+        return;
+    }
+
+    if (cmd == "append") {
+        std::string path, text;
+        ss >> path;
+        std::getline(ss >> std::ws, text);
+        vfs.cmdAppend(path, text, in);
+        return;
+    }
+
+    if (cmd == "insert") {
+        std::string path, text;
+        size_t offset = 0;
+        if (!(ss >> path >> offset)) {
+            out << "insert: usage: insert <path> <offset> [text]\n";
+            return;
+        }
+        std::getline(ss >> std::ws, text);
+        vfs.cmdInsert(path, offset, text, in);
         return;
     }
 
     if (cmd == "rm") {
-        std::string firstArg;
-        std::string path;
-        ss >> firstArg;
+        std::vector<std::string> paths = expandArgs(ss);
         bool recursive = false;
 
-        if (firstArg == "-r") {
+        if (!paths.empty() && paths[0] == "-r") {
             recursive = true;
-            ss >> path;
-        }
-        else {
-            path = firstArg;
+            paths.erase(paths.begin());
         }
 
-        vfs.cmdRm(path, recursive);
+        if (paths.size() <= 1)
+            vfs.cmdRm(paths.empty() ? "" : paths[0], recursive);
+        else
+            vfs.cmdBatch("rm", batchOps(TxOp::Kind::Rm, paths, "", recursive));
         return;
     }
 
     if (cmd == "cp") {
-        std::string src, dst;
-        ss >> src >> dst;
-        vfs.cmdCp(src, dst);
+        std::vector<std::string> paths = expandArgs(ss);
+        //into the last argument when it is a directory, however many
+        //sources a pattern turned into; a plain copy otherwise
+        if (paths.size() > 2 || (paths.size() == 2 && isDirectory(paths[1]))) {
+            std::string dst = paths.back();
+            paths.pop_back();
+            vfs.cmdCpInto(paths, dst);
+        }
+        else {
+            paths.resize(2);
+            vfs.cmdCp(paths[0], paths[1]);
+        }
         return;
     }
 
@@ -135,39 +333,337 @@ void Shell::handleCommand(const std::string& line) {
 
     if (cmd == "chmod") {
         std::string perms;
-        std::string path;
-        ss >> perms >> path;
-        vfs.cmdChmod(perms, path);
+        ss >> perms;
+        std::vector<std::string> paths = expandArgs(ss);
+        if (paths.size() <= 1)
+            vfs.cmdChmod(perms, paths.empty() ? "" : paths[0]);
+        else
+            vfs.cmdBatch("chmod", batchOps(TxOp::Kind::Chmod, paths, perms, false));
+        return;
+    }
+
+    if (cmd == "import") {
+        std::string hostDir, vfsDir;
+        ss >> hostDir >> vfsDir;
+        vfs.cmdImport(hostDir, vfsDir);
+        return;
+    }
+
+    if (cmd == "export") {
+        std::string vfsDir, hostDir;
+        ss >> vfsDir >> hostDir;
+        vfs.cmdExport(vfsDir, hostDir);
+        return;
+    }
+
+    if (cmd == "tar") {
+        std::string mode, archive, vfsDir;
+        ss >> mode >> archive >> vfsDir;
+
+        if (mode == "-c")
+            vfs.cmdTarCreate(archive, vfsDir);
+        else if (mode == "-x")
+            vfs.cmdTarExtract(archive, vfsDir);
+        else
+            out << "tar: use -c or -x\n";
         return;
     }
 
     if (cmd == "tree") {
-        vfs.cmdTree();
+        vfs.cmdTree(out);
+        return;
+    }
+
+    if (cmd == "mount") {
+        std::string snapshot, path;
+        ss >> snapshot >> path;
+        if (snapshot.empty())
+            vfs.cmdMounts();
+        else
+            vfs.cmdMount(snapshot, path);
+        return;
+    }
+
+    if (cmd == "unmount") {
+        std::string path;
+        ss >> path;
+        vfs.cmdUnmount(path);
+        return;
+    }
+
+    if (cmd == "begin") {
+        if (inTransaction) {
+            out << "begin: transaction already open\n";
+            return;
+        }
+        inTransaction = true;
+        staged.clear();
+        out << "Transaction started.\n";
+        return;
+    }
+
+    if (cmd == "commit" || cmd == "abort") {
+        if (!inTransaction) {
+            out << cmd << ": no open transaction\n";
+            return;
+        }
+        inTransaction = false;
+
+        if (cmd == "abort") {
+            out << "Transaction aborted (" << staged.size() << " operations dropped).\n";
+            staged.clear();
+            return;
+        }
+
+        size_t failedOp = 0;
+        VfsStatus st = vfs.commitTransaction(staged, failedOp);
+        if (st == VfsStatus::Ok) {
+            out << "Transaction committed (" << staged.size() << " operations).\n";
+        }
+        else if (failedOp < staged.size()) {
+            out << "commit: " << staged[failedOp].path << ": " << statusMessage(st) << "\n";
+            out << "Transaction rolled back; no changes applied.\n";
+        }
+        else {
+            out << "commit: journal write failed; changes are in memory only until the next save\n";
+        }
+        staged.clear();
+        return;
+    }
+
+    if (cmd == "watch") {
+        std::string path;
+        if (!(ss >> path)) {
+            if (watches.empty())
+                out << "No watches.\n";
+            for (const auto& w : watches)
+                out << w->getPrefix() << "\n";
+            return;
+        }
+
+        std::string prefix = watchPrefix(path);
+        for (const auto& w : watches) {
+            if (w->getPrefix() == prefix) {
+                out << "watch: already watching " << prefix << "\n";
+                return;
+            }
+        }
+
+        watches.push_back(std::make_unique<EventSubscription>());
+        vfs.eventStream().subscribe(*watches.back(), prefix);
+        out << "Watching " << prefix << "\n";
+        return;
+    }
+
+    if (cmd == "unwatch") {
+        std::string path;
+        ss >> path;
+        std::string prefix = watchPrefix(path);
+
+        auto it = std::find_if(watches.begin(), watches.end(),
+            [&](const std::unique_ptr<EventSubscription>& w) { return w->getPrefix() == prefix; });
+        if (it == watches.end()) {
+            out << "unwatch: not watching " << prefix << "\n";
+            return;
+        }
+        watches.erase(it);
+        return;
+    }
+
+    if (cmd == "events") {
+        printEvents();
+        return;
+    }
+
+    if (cmd == "trace") {
+        std::string action, path;
+        ss >> action >> path;
+
+        if (action == "start") {
+            if (trace) {
+                out << "trace: already recording\n";
+            }
+            else if (path.empty()) {
+                out << "trace: missing file\n";
+            }
+            else if (startTrace(path)) {
+                out << "Tracing to " << path << "\n";
+            }
+            else {
+                out << "trace: cannot open " << path << "\n";
+            }
+        }
+        else if (action == "stop") {
+            if (!trace) {
+                out << "trace: not recording\n";
+                return;
+            }
+            uint64_t count = trace->recordCount();
+            stopTrace();
+            out << "Trace stopped (" << count << " commands).\n";
+        }
+        else {
+            out << (trace ? "trace: recording\n" : "trace: not recording\n");
+        }
+        return;
+    }
+
+    if (cmd == "budget") {
+        size_t bytes = 0;
+        if (!(ss >> bytes)) {
+            out << "budget: missing byte count\n";
+            return;
+        }
+        vfs.cmdBudget(bytes);
+        return;
+    }
+
+    if (cmd == "stats") {
+        vfs.cmdStats();
+        printShellMemory();
+        return;
+    }
+
+    if (cmd == "mem") {
+        std::string path;
+        ss >> path;
+        if (vfs.cmdMem(path) && (path.empty() || path == "/"))
+            printShellMemory();
         return;
     }
 
     if (cmd == "save") {
         vfs.save();
-        std::cout << "File system saved.\n";
+        out << "File system saved.\n";
         return;
     }
 
     if (cmd == "history") {
         for (size_t i = 0; i < history.size(); ++i) {
-            std::cout << i + 1 << "  " << history[i] << "\n";
+            out << i + 1 << "  " << history[i] << "\n";
         }
         return;
     }
 
-    std::cout << "Unknown command: " << cmd << "\n";
-    std::cout << "Type 'help' to see available commands.\n";
+    out << "Unknown command: " << cmd << "\n";
+    out << "Type 'help' to see available commands.\n";
+}
+
+std::string Shell::watchPrefix(const std::string& path) const {
+    //existing paths are canonicalized; others are taken as written
+    const VFSNode* node = nullptr;
+    std::string prefix = vfs.lookup(path, node) == VfsStatus::Ok ? vfs.pathOf(node) : vfs.absolutePath(path);
+    while (prefix.size() > 1 && prefix.back() == '/')
+        prefix.pop_back();
+    return prefix;
+}
+
+void Shell::printEvents() {
+    std::vector<VfsEvent> pending;
+    size_t shown = 0;
+
+    for (const auto& w : watches) {
+        pending.clear();
+        vfs.eventStream().poll(*w, pending, SIZE_MAX);
+
+        for (const auto& ev : pending) {
+            out << "[" << w->getPrefix() << "] " << eventKindName(ev.kind);
+            if (ev.kind == VfsEvent::Kind::Overflow) {
+                out << ": " << ev.lost << " events lost\n";
+            }
+            else {
+                out << " " << ev.path;
+                if (!ev.target.empty())
+                    out << " -> " << ev.target;
+                out << (ev.truncated ? " (truncated)\n" : "\n");
+            }
+            ++shown;
+        }
+    }
+
+    if (shown == 0)
+        out << "No new events.\n";
+}
+
+bool Shell::startTrace(const std::string& path) {
+    auto writer = std::make_unique<TraceWriter>(path);
+    if (!writer->isOpen())
+        return false;
+
+    trace = std::move(writer);
+    recorder = std::make_unique<TraceInputRecorder>(in.rdbuf());
+    in.rdbuf(recorder.get());
+    traceStart = std::chrono::steady_clock::now();
+    return true;
+}
+
+void Shell::stopTrace() {
+    if (!trace)
+        return;
+
+    in.rdbuf(recorder->getSource());
+    if (!trace->close())
+        out << "trace: write failed, trace is incomplete\n";
+    trace.reset();
+    recorder.reset();
+}
+
+size_t Shell::memoryBytes() const {
+    size_t bytes = history.capacity() * sizeof(std::string);
+    for (const auto& h : history)
+        bytes += stringHeapBytes(h);
+
+    bytes += staged.capacity() * sizeof(TxOp);
+    for (const auto& op : staged)
+        bytes += stringHeapBytes(op.path) + stringHeapBytes(op.arg);
+
+    bytes += watches.capacity() * sizeof(std::unique_ptr<EventSubscription>);
+    for (const auto& w : watches)
+        bytes += sizeof(EventSubscription) + stringHeapBytes(w->getPrefix());
+
+    if (recorder)
+        bytes += sizeof(TraceInputRecorder) + stringHeapBytes(recorder->getCaptured());
+    return bytes;
+}
+
+void Shell::printShellMemory() const {
+    out << "shell state:       " << memoryBytes() << " bytes (" << history.size()
+        << " history entries, " << staged.size() << " staged operations)\n";
+}
+
+void Shell::execute(const std::string& line) {
+    addToHistory(line);
+
+    if (!trace) {
+        handleCommand(line);
+        return;
+    }
+
+    using namespace std::chrono;
+    recorder->startCommand();
+    auto start = steady_clock::now();
+    handleCommand(line);
+
+    //trace stop ends the recording without itself being recorded
+    if (!trace)
+        return;
+
+    uint64_t total = duration_cast<microseconds>(steady_clock::now() - start).count();
+    uint64_t waited = recorder->getWaitedMicros();
+
+    TraceRecord rec;
+    rec.startMicros = duration_cast<microseconds>(start - traceStart).count();
+    rec.durationMicros = total > waited ? total - waited : 0;
+    rec.line = line;
+    rec.input = recorder->getCaptured();
+    trace->write(rec);
 }
 
 void Shell::run() {
     while (running) {
         printPrompt();
         std::string line;
-        if (!std::getline(std::cin, line)) {
+        if (!std::getline(in, line)) {
             break;
         }
 
@@ -183,7 +679,6 @@ void Shell::run() {
             continue;
         }
 
-        addToHistory(line);
-        handleCommand(line);
+        execute(line);
     }
 }
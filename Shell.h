@@ -1,21 +1,55 @@
 #pragma once
 
 #include "VirtualFileSystem.h"
+#include "Trace.h"
 #include <string>
 #include <vector>
+#include <sstream>
+#include <memory>
+#include <chrono>
 
 class Shell {
 private:
     VirtualFileSystem& vfs;
+    std::istream& in;
+    std::ostream& out;
     std::vector<std::string> history;
     bool running;
 
+    //open transaction: mutating commands are staged here until commit
+    bool inTransaction;
+    std::vector<TxOp> staged;
+
+    //subtrees being watched for changes
+    std::vector<std::unique_ptr<EventSubscription>> watches;
+
+    //command trace being recorded, with the recorder spliced into `in`
+    std::unique_ptr<TraceWriter> trace;
+    std::unique_ptr<TraceInputRecorder> recorder;
+    std::chrono::steady_clock::time_point traceStart;
+
     void addToHistory(const std::string& line);
     void printPrompt() const;
     void handleCommand(const std::string& line);
+    bool stageCommand(const std::string& cmd, std::stringstream& ss);
+    std::vector<std::string> expandArgs(std::stringstream& ss) const;
+    bool isDirectory(const std::string& path) const;
+    std::vector<TxOp> batchOps(TxOp::Kind kind, const std::vector<std::string>& paths,
+        const std::string& arg, bool recursive) const;
+    std::string watchPrefix(const std::string& path) const;
+    void printEvents();
+    bool startTrace(const std::string& path);
+    void stopTrace();
+    size_t memoryBytes() const;
+    void printShellMemory() const;
 
 public:
-    Shell(VirtualFileSystem& vfs);
+    //out also becomes the console of vfs
+    Shell(VirtualFileSystem& vfs, std::istream& in = std::cin, std::ostream& out = std::cout);
+    ~Shell();
 
     void run();
+
+    //handle one already-trimmed command line, as if typed at the prompt
+    void execute(const std::string& line);
 };
@@ -0,0 +1,391 @@
+#include "TarArchive.h"
+
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+
+namespace {
+
+const size_t BLOCK = 512;
+const size_t CHUNK = 64 * 1024;
+const uint64_t MAX_OCTAL_SIZE = 077777777777ULL; //11 octal digits
+const uint64_t MAX_EXTENDED_HEADER = 1024 * 1024;  //pax records and gnu long names
+
+void putOctal(char* field, size_t width, uint64_t value) {
+    //width includes the terminating NUL
+    std::memset(field, '0', width - 1);
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i > 0 && value > 0; --i) {
+        field[i - 1] = static_cast<char>('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+uint64_t getNumber(const char* field, size_t width) {
+    //gnu base-256 for values that do not fit in octal
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+        uint64_t value = static_cast<unsigned char>(field[0]) & 0x7f;
+        for (size_t i = 1; i < width; ++i)
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        return value;
+    }
+
+    uint64_t value = 0;
+    size_t i = 0;
+    while (i < width && (field[i] == ' ' || field[i] == '\0')) ++i;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i)
+        value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+    return value;
+}
+
+std::string getString(const char* field, size_t width) {
+    return std::string(field, strnlen(field, width));
+}
+
+unsigned checksum(const char* block) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < BLOCK; ++i) {
+        bool inField = i >= 148 && i < 156;
+        sum += inField ? ' ' : static_cast<unsigned char>(block[i]);
+    }
+    return sum;
+}
+
+//"<len> key=value\n" where len counts the whole record, itself included
+std::string paxRecord(const std::string& key, const std::string& value) {
+    size_t body = key.size() + value.size() + 3;
+    size_t len = body + 1;
+    while (std::to_string(len).size() + body != len)
+        len = std::to_string(len).size() + body;
+    return std::to_string(len) + " " + key + "=" + value + "\n";
+}
+
+}
+
+unsigned tarModeFromPermissions(const std::string& perms, bool directory) {
+    unsigned owner = 0;
+    if (perms.find('r') != std::string::npos) owner |= 4;
+    if (perms.find('w') != std::string::npos) owner |= 2;
+    if (perms.find('x') != std::string::npos) owner |= 1;
+    //group/other get read (and search for directories) so extracted trees stay usable
+    unsigned rest = directory ? 5 : 4;
+    return (owner << 6) | (rest << 3) | rest;
+}
+
+std::string tarPermissionsFromMode(unsigned mode) {
+    std::string perms = "---";
+    if (mode & 0400) perms[0] = 'r';
+    if (mode & 0200) perms[1] = 'w';
+    if (mode & 0100) perms[2] = 'x';
+    return perms;
+}
+
+//TarWriter
+
+TarWriter::TarWriter(std::ostream& out)
+    : out(out), remaining(0), entrySize(0) {
+}
+
+void TarWriter::writeHeader(const std::string& name, const std::string& prefix,
+    char typeFlag, uint64_t size, unsigned mode) {
+    char block[BLOCK];
+    std::memset(block, 0, BLOCK);
+
+    std::memcpy(block, name.data(), std::min(name.size(), size_t(100)));
+    putOctal(block + 100, 8, mode);
+    putOctal(block + 108, 8, 0);
+    putOctal(block + 116, 8, 0);
+    putOctal(block + 124, 12, size > MAX_OCTAL_SIZE ? 0 : size);
+    putOctal(block + 136, 12, static_cast<uint64_t>(std::time(nullptr)));
+    block[156] = typeFlag;
+    std::memcpy(block + 257, "ustar", 6);
+    std::memcpy(block + 263, "00", 2);
+    std::memcpy(block + 345, prefix.data(), std::min(prefix.size(), size_t(155)));
+
+    putOctal(block + 148, 7, checksum(block));
+    block[155] = ' ';
+
+    out.write(block, BLOCK);
+}
+
+void TarWriter::writePaxHeader(const std::string& path, uint64_t size, bool needPath, bool needSize) {
+    std::string records;
+    if (needPath) records += paxRecord("path", path);
+    if (needSize) records += paxRecord("size", std::to_string(size));
+
+    writeHeader("PaxHeader", "", 'x', records.size(), 0644);
+    out.write(records.data(), static_cast<std::streamsize>(records.size()));
+    pad(records.size());
+}
+
+void TarWriter::writeEntryHeader(const std::string& path, char typeFlag, uint64_t size, unsigned mode) {
+    std::string name = path;
+    std::string prefix;
+
+    if (name.size() > 100) {
+        //ustar can split a long path at a slash into prefix + name
+        size_t split = path.find('/', path.size() > 101 ? path.size() - 101 : 0);
+        if (split != std::string::npos && split <= 155 && path.size() - split - 1 <= 100
+            && split > 0) {
+            prefix = path.substr(0, split);
+            name = path.substr(split + 1);
+        }
+    }
+
+    bool needPath = name.size() > 100;
+    bool needSize = size > MAX_OCTAL_SIZE;
+    if (needPath || needSize) {
+        writePaxHeader(path, size, needPath, needSize);
+        if (needPath) {
+            name = path.substr(0, 100);
+            prefix.clear();
+        }
+    }
+
+    writeHeader(name, prefix, typeFlag, size, mode);
+}
+
+void TarWriter::pad(uint64_t size) {
+    static const char zeros[BLOCK] = {};
+    size_t rest = static_cast<size_t>(size % BLOCK);
+    if (rest)
+        out.write(zeros, static_cast<std::streamsize>(BLOCK - rest));
+}
+
+void TarWriter::addDirectory(const std::string& path, unsigned mode) {
+    std::string dirPath = path;
+    if (dirPath.empty() || dirPath.back() != '/')
+        dirPath += '/';
+    writeEntryHeader(dirPath, '5', 0, mode);
+}
+
+void TarWriter::beginFile(const std::string& path, unsigned mode, uint64_t size) {
+    writeEntryHeader(path, '0', size, mode);
+    remaining = size;
+    entrySize = size;
+}
+
+void TarWriter::write(const char* data, size_t len) {
+    if (len > remaining) {
+        out.setstate(std::ios::failbit);
+        return;
+    }
+    out.write(data, static_cast<std::streamsize>(len));
+    remaining -= len;
+}
+
+void TarWriter::endFile() {
+    if (remaining != 0) {
+        out.setstate(std::ios::failbit);
+        return;
+    }
+    pad(entrySize);
+}
+
+void TarWriter::finish() {
+    static const char zeros[BLOCK * 2] = {};
+    out.write(zeros, sizeof(zeros));
+    out.flush();
+}
+
+bool TarWriter::good() const {
+    return static_cast<bool>(out);
+}
+
+//TarReader
+
+TarReader::TarReader(std::istream& in)
+    : in(in), remaining(0), padding(0), streamEnd(UNKNOWN_END) {
+    //when the archive is a seekable file, entry sizes can be checked
+    //against what is actually there before trusting them
+    std::streampos start = in.tellg();
+    if (start != std::streampos(-1) && in.seekg(0, std::ios::end)) {
+        std::streampos end = in.tellg();
+        if (end != std::streampos(-1))
+            streamEnd = static_cast<uint64_t>(end);
+        in.seekg(start);
+    }
+    in.clear();
+}
+
+bool TarReader::fits(uint64_t size) {
+    if (streamEnd == UNKNOWN_END)
+        return true;
+    std::streampos pos = in.tellg();
+    if (pos == std::streampos(-1))
+        return true;
+    uint64_t at = static_cast<uint64_t>(pos);
+    return at <= streamEnd && size <= streamEnd - at;
+}
+
+bool TarReader::readBlock(char* block) {
+    in.read(block, BLOCK);
+    return in.gcount() == static_cast<std::streamsize>(BLOCK);
+}
+
+bool TarReader::skipBytes(uint64_t count) {
+    char buffer[BLOCK * 8];
+    while (count > 0) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(count, sizeof(buffer)));
+        in.read(buffer, static_cast<std::streamsize>(n));
+        if (in.gcount() != static_cast<std::streamsize>(n))
+            return false;
+        count -= n;
+    }
+    return true;
+}
+
+bool TarReader::readPax(uint64_t size, std::string& path, uint64_t& paxSize, bool& hasSize) {
+    //extended headers are small key=value lists; anything huge is not one we handle
+    if (size > MAX_EXTENDED_HEADER) {
+        lastError = "pax header too large";
+        return false;
+    }
+
+    std::string records(static_cast<size_t>(size), '\0');
+    in.read(&records[0], static_cast<std::streamsize>(size));
+    if (in.gcount() != static_cast<std::streamsize>(size) || !skipBytes((BLOCK - size % BLOCK) % BLOCK)) {
+        lastError = "truncated pax header";
+        return false;
+    }
+
+    size_t pos = 0;
+    while (pos < records.size()) {
+        size_t space = records.find(' ', pos);
+        if (space == std::string::npos) break;
+        size_t len = std::strtoull(records.c_str() + pos, nullptr, 10);
+        if (len == 0 || pos + len > records.size()) break;
+
+        std::string record = records.substr(space + 1, pos + len - space - 2);
+        size_t eq = record.find('=');
+        if (eq != std::string::npos) {
+            std::string key = record.substr(0, eq);
+            std::string value = record.substr(eq + 1);
+            if (key == "path")
+                path = value;
+            else if (key == "size") {
+                paxSize = std::strtoull(value.c_str(), nullptr, 10);
+                hasSize = true;
+            }
+        }
+        pos += len;
+    }
+    return true;
+}
+
+bool TarReader::next(Entry& entry) {
+    if (!skipData())
+        return false;
+
+    std::string overridePath;
+    uint64_t overrideSize = 0;
+    bool hasSize = false;
+    char block[BLOCK];
+
+    while (true) {
+        if (!readBlock(block)) {
+            //archives that stop without the zero blocks are still accepted
+            if (in.gcount() != 0)
+                lastError = "truncated header";
+            return false;
+        }
+
+        bool zero = std::all_of(block, block + BLOCK, [](char c) { return c == 0; });
+        if (zero)
+            return false;
+
+        if (getNumber(block + 148, 8) != checksum(block)) {
+            lastError = "bad header checksum";
+            return false;
+        }
+
+        char type = block[156];
+        uint64_t size = getNumber(block + 124, 12);
+
+        if (type == 'x') {
+            if (!readPax(size, overridePath, overrideSize, hasSize))
+                return false;
+            continue;
+        }
+        if (type == 'g') {
+            if (!skipBytes(size + (BLOCK - size % BLOCK) % BLOCK)) {
+                lastError = "truncated archive";
+                return false;
+            }
+            continue;
+        }
+        if (type == 'L') {
+            //gnu long name: the data block holds the path
+            if (size > MAX_EXTENDED_HEADER) {
+                lastError = "long name too large";
+                return false;
+            }
+            overridePath.clear();
+            remaining = size;
+            padding = (BLOCK - size % BLOCK) % BLOCK;
+            if (!readData(overridePath))
+                return false;
+            while (!overridePath.empty() && overridePath.back() == '\0')
+                overridePath.pop_back();
+            continue;
+        }
+
+        std::string name = getString(block, 100);
+        std::string prefix = std::memcmp(block + 257, "ustar", 5) == 0 ? getString(block + 345, 155) : "";
+
+        entry.path = !overridePath.empty() ? overridePath
+            : (prefix.empty() ? name : prefix + "/" + name);
+        entry.type = type == '\0' ? '0' : type;
+        entry.size = hasSize ? overrideSize : size;
+        entry.mode = static_cast<unsigned>(getNumber(block + 100, 8));
+
+        //only regular files carry data we care about, but every type is sized
+        remaining = entry.type == '5' ? 0 : entry.size;
+        padding = (BLOCK - remaining % BLOCK) % BLOCK;
+        if (!fits(remaining)) {
+            lastError = "entry size runs past the end of the archive";
+            remaining = 0;
+            padding = 0;
+            return false;
+        }
+        return true;
+    }
+}
+
+bool TarReader::readData(std::string& out) {
+    //the size comes from the header, so the string only grows as bytes arrive
+    char buffer[CHUNK];
+
+    while (remaining > 0) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(remaining, CHUNK));
+        in.read(buffer, static_cast<std::streamsize>(n));
+        size_t got = static_cast<size_t>(in.gcount());
+        out.append(buffer, got);
+        remaining -= got;
+        if (got != n) {
+            lastError = "truncated entry data";
+            return false;
+        }
+    }
+
+    if (!skipBytes(padding)) {
+        lastError = "truncated archive";
+        return false;
+    }
+    padding = 0;
+    return true;
+}
+
+bool TarReader::skipData() {
+    if (!skipBytes(remaining + padding)) {
+        lastError = "truncated archive";
+        return false;
+    }
+    remaining = 0;
+    padding = 0;
+    return true;
+}
+
+const std::string& TarReader::error() const {
+    return lastError;
+}
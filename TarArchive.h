@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+//streaming ustar/pax archives. both sides only ever hold one 512-byte
+//header block and one fixed-size data buffer, never the whole archive.
+
+class TarWriter {
+private:
+    std::ostream& out;
+    uint64_t remaining;
+    uint64_t entrySize;
+
+    void writeHeader(const std::string& name, const std::string& prefix,
+        char typeFlag, uint64_t size, unsigned mode);
+    void writePaxHeader(const std::string& path, uint64_t size, bool needPath, bool needSize);
+    void writeEntryHeader(const std::string& path, char typeFlag, uint64_t size, unsigned mode);
+    void pad(uint64_t size);
+
+public:
+    explicit TarWriter(std::ostream& out);
+
+    void addDirectory(const std::string& path, unsigned mode);
+
+    //a file entry is written as beginFile, any number of write calls
+    //totalling exactly `size` bytes, then endFile
+    void beginFile(const std::string& path, unsigned mode, uint64_t size);
+    void write(const char* data, size_t len);
+    void endFile();
+
+    //end-of-archive marker
+    void finish();
+    bool good() const;
+};
+
+class TarReader {
+public:
+    struct Entry {
+        std::string path;
+        char type;      //'0' file, '5' directory, anything else is skipped by callers
+        uint64_t size;
+        unsigned mode;
+    };
+
+private:
+    static const uint64_t UNKNOWN_END = ~uint64_t(0);
+
+    std::istream& in;
+    uint64_t remaining;
+    uint64_t padding;
+    uint64_t streamEnd; //archive length when the stream can seek, else UNKNOWN_END
+    std::string lastError;
+
+    bool readBlock(char* block);
+    bool fits(uint64_t size); //size more bytes are left in the archive
+    bool skipBytes(uint64_t count);
+    bool readPax(uint64_t size, std::string& path, uint64_t& paxSize, bool& hasSize);
+
+public:
+    explicit TarReader(std::istream& in);
+
+    //advances to the next entry header, skipping any unread data.
+    //returns false at end of archive or on error (see error())
+    bool next(Entry& entry);
+
+    //appends the current entry's data to `out` in fixed-size chunks
+    bool readData(std::string& out);
+    bool skipData();
+
+    const std::string& error() const;
+};
+
+//owner permission bits <-> "rwx" strings
+unsigned tarModeFromPermissions(const std::string& perms, bool directory);
+std::string tarPermissionsFromMode(unsigned mode);
@@ -0,0 +1,142 @@
+#include "Trace.h"
+
+#include <iterator>
+#include <chrono>
+
+namespace {
+
+const char TRACE_MAGIC[4] = { 'V', 'T', 'R', '1' };
+
+void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+bool getVarint(const std::string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size())
+            return false;
+        unsigned char b = static_cast<unsigned char>(in[pos++]);
+        v |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool getString(const std::string& in, size_t& pos, std::string& s) {
+    uint64_t len = 0;
+    if (!getVarint(in, pos, len) || len > in.size() - pos)
+        return false;
+    s.assign(in, pos, static_cast<size_t>(len));
+    pos += static_cast<size_t>(len);
+    return true;
+}
+
+}
+
+TraceWriter::TraceWriter(const std::string& path)
+    : out(path, std::ios::binary | std::ios::trunc), lastStart(0), records(0) {
+    out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+}
+
+bool TraceWriter::isOpen() const {
+    return out.is_open() && out.good();
+}
+
+void TraceWriter::write(const TraceRecord& rec) {
+    std::string buf;
+    putVarint(buf, rec.startMicros - lastStart);
+    putVarint(buf, rec.durationMicros);
+    putVarint(buf, rec.line.size());
+    buf += rec.line;
+    putVarint(buf, rec.input.size());
+    buf += rec.input;
+
+    out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+    lastStart = rec.startMicros;
+    ++records;
+}
+
+uint64_t TraceWriter::recordCount() const {
+    return records;
+}
+
+bool TraceWriter::close() {
+    out.close();
+    return !out.fail();
+}
+
+TraceInputRecorder::TraceInputRecorder(std::streambuf* source)
+    : source(source), waitedMicros(0) {
+}
+
+TraceInputRecorder::int_type TraceInputRecorder::underflow() {
+    if (source->in_avail() > 0)
+        return source->sgetc();
+
+    auto start = std::chrono::steady_clock::now();
+    int_type c = source->sgetc();
+    waitedMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return c;
+}
+
+TraceInputRecorder::int_type TraceInputRecorder::uflow() {
+    underflow();
+    int_type c = source->sbumpc();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+        captured.push_back(traits_type::to_char_type(c));
+    return c;
+}
+
+std::streambuf* TraceInputRecorder::getSource() const {
+    return source;
+}
+
+void TraceInputRecorder::startCommand() {
+    captured.clear();
+    waitedMicros = 0;
+}
+
+const std::string& TraceInputRecorder::getCaptured() const {
+    return captured;
+}
+
+uint64_t TraceInputRecorder::getWaitedMicros() const {
+    return waitedMicros;
+}
+
+bool readTrace(const std::string& path, std::vector<TraceRecord>& out, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "cannot open trace";
+        return false;
+    }
+
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.size() < sizeof(TRACE_MAGIC) || data.compare(0, sizeof(TRACE_MAGIC), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        error = "not a vsh trace";
+        return false;
+    }
+
+    size_t pos = sizeof(TRACE_MAGIC);
+    uint64_t start = 0;
+    while (pos < data.size()) {
+        TraceRecord rec;
+        uint64_t delta = 0;
+        if (!getVarint(data, pos, delta) || !getVarint(data, pos, rec.durationMicros)
+            || !getString(data, pos, rec.line) || !getString(data, pos, rec.input)) {
+            error = "trace truncated after " + std::to_string(out.size()) + " records";
+            return false;
+        }
+        start += delta;
+        rec.startMicros = start;
+        out.push_back(std::move(rec));
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <streambuf>
+#include <cstdint>
+
+//one command handled by the shell. `input` is everything the command read
+//from the shell's input after its own line (e.g. the body of a write)
+struct TraceRecord {
+    uint64_t startMicros;    //since the trace started
+    uint64_t durationMicros; //time spent handling it, minus waiting for input
+    std::string line;
+    std::string input;
+};
+
+//compact binary trace: a magic header, then per record the start delta,
+//duration and both strings, all lengths and times as LEB128 varints
+class TraceWriter {
+private:
+    std::ofstream out;
+    uint64_t lastStart;
+    uint64_t records;
+
+public:
+    explicit TraceWriter(const std::string& path);
+
+    bool isOpen() const;
+    void write(const TraceRecord& rec);
+    uint64_t recordCount() const;
+
+    //false if anything failed to reach the file
+    bool close();
+};
+
+//sits between the shell and its input while tracing: passes characters
+//through, keeps what the current command consumed, and measures how long
+//reads blocked so waiting for the user is not counted as work
+class TraceInputRecorder : public std::streambuf {
+private:
+    std::streambuf* source;
+    std::string captured;
+    uint64_t waitedMicros;
+
+protected:
+    int_type underflow() override;
+    int_type uflow() override;
+
+public:
+    explicit TraceInputRecorder(std::streambuf* source);
+
+    std::streambuf* getSource() const;
+
+    void startCommand();
+    const std::string& getCaptured() const;
+    uint64_t getWaitedMicros() const;
+};
+
+//reads a whole trace; false (with `error` set) on a bad header or a
+//truncated record. records before the damage are kept
+bool readTrace(const std::string& path, std::vector<TraceRecord>& out, std::string& error);
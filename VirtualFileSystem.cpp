@@ -1,21 +1,42 @@
 #include "VirtualFileSystem.h"
+#include "TarArchive.h"
 
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
 #include <functional>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <iomanip>
+
+namespace fs = std::filesystem;
 
 //VFSNode implementation
 
 VFSNode::VFSNode(const std::string& name, Type type, VFSNode* parent)
-    : name(name), type(type), parent(parent), permissions("rwx") {
+    : name(name), type(type), parent(parent), permissions("rwx"), store(nullptr), volume(nullptr) {
+}
+
+VFSNode::~VFSNode() {
+    if (store)
+        store->forget(this);
 }
 
 const std::string& VFSNode::getName() const {
     return name;
 }
 
+void VFSNode::setName(const std::string& newName) {
+    name = newName;
+}
+
 VFSNode::Type VFSNode::getType() const {
     return type;
 }
@@ -32,11 +53,11 @@ const std::string& VFSNode::getPermissions() const {
     return permissions;
 }
 
-std::string& VFSNode::getContent() {
+Rope& VFSNode::getContent() {
     return content;
 }
 
-const std::string& VFSNode::getContentConst() const {
+const Rope& VFSNode::getContentConst() const {
     return content;
 }
 
@@ -48,6 +69,14 @@ bool VFSNode::isFile() const {
     return type == Type::File;
 }
 
+Volume* VFSNode::getVolume() const {
+    return volume;
+}
+
+void VFSNode::setVolume(Volume* vol) {
+    volume = vol;
+}
+
 std::vector<std::unique_ptr<VFSNode>>& VFSNode::getChildren() {
     return children;
 }
@@ -56,53 +85,114 @@ const std::vector<std::unique_ptr<VFSNode>>& VFSNode::getChildrenConst() const {
     return children;
 }
 
-VFSNode* VFSNode::findChild(const std::string& name) {
-    for (auto& child : children) {
-        if (child->getName() == name)
-            return child.get();
-    }
-    return nullptr;
+VFSNode* VFSNode::findChild(std::string_view name) {
+    auto it = childIndex.find(name);
+    return it == childIndex.end() ? nullptr : it->second;
 }
 
-const VFSNode* VFSNode::findChildConst(const std::string& name) const {
-    for (const auto& child : children) {
-        if (child->getName() == name)
-            return child.get();
-    }
-    return nullptr;
+const VFSNode* VFSNode::findChildConst(std::string_view name) const {
+    auto it = childIndex.find(name);
+    return it == childIndex.end() ? nullptr : it->second;
 }
 
 VFSNode* VFSNode::addDirectory(const std::string& name) {
     children.push_back(std::make_unique<VFSNode>(name, Type::Directory, this));
+    childIndex[name] = children.back().get();
     return children.back().get();
 }
 
 VFSNode* VFSNode::addFile(const std::string& name) {
     children.push_back(std::make_unique<VFSNode>(name, Type::File, this));
+    childIndex[name] = children.back().get();
     return children.back().get();
 }
 
 bool VFSNode::removeChild(const std::string& name) {
+    if (childIndex.erase(name) == 0)
+        return false;
+
     auto it = std::remove_if(children.begin(), children.end(),
         [&](const std::unique_ptr<VFSNode>& n) {
             return n->getName() == name;
         });
+    children.erase(it, children.end());
+    return true;
+}
 
-    if (it != children.end()) {
-        children.erase(it, children.end());
-        return true;
-    }
-    return false;
+void VFSNode::removeChildren(const std::vector<const VFSNode*>& doomed) {
+    for (const VFSNode* n : doomed)
+        childIndex.erase(n->getName());
+
+    std::vector<const VFSNode*> sorted(doomed);
+    std::sort(sorted.begin(), sorted.end());
+    auto it = std::remove_if(children.begin(), children.end(),
+        [&](const std::unique_ptr<VFSNode>& n) {
+            return std::binary_search(sorted.begin(), sorted.end(), n.get());
+        });
+    children.erase(it, children.end());
+}
+
+std::unique_ptr<VFSNode> VFSNode::detachChild(const std::string& name) {
+    if (childIndex.erase(name) == 0)
+        return nullptr;
+
+    auto it = std::find_if(children.begin(), children.end(),
+        [&](const std::unique_ptr<VFSNode>& n) {
+            return n->getName() == name;
+        });
+    std::unique_ptr<VFSNode> node = std::move(*it);
+    children.erase(it);
+    node->parent = nullptr;
+    return node;
+}
+
+VFSNode* VFSNode::adoptChild(std::unique_ptr<VFSNode> child) {
+    child->parent = this;
+    children.push_back(std::move(child));
+    childIndex[children.back()->getName()] = children.back().get();
+    return children.back().get();
 }
 
-void VFSNode::listChildren(bool showPermissions) const {
+std::vector<std::unique_ptr<VFSNode>> VFSNode::releaseChildren() {
+    childIndex.clear();
+    return std::move(children);
+}
+
+std::string VFSNode::listPage(const std::string& cursor, size_t limit,
+    std::vector<const VFSNode*>& out) const {
+    //name cursors stay valid while entries are added or removed around them
+    auto it = cursor.empty() ? childIndex.begin() : childIndex.upper_bound(cursor);
+
+    for (size_t n = 0; it != childIndex.end() && n < limit; ++it, ++n)
+        out.push_back(it->second);
+
+    if (it == childIndex.end() || out.empty())
+        return "";
+    return out.back()->getName();
+}
+
+void VFSNode::accountMemory(MemoryUsage& usage) const {
+    //a red-black tree node is three links and a colour next to the key/value
+    const size_t indexNode = sizeof(std::pair<const std::string, VFSNode*>) + 4 * sizeof(void*);
+
+    usage.nodes += 1;
+    usage.headers += sizeof(VFSNode);
+    usage.names += stringHeapBytes(name);
+    usage.permissions += stringHeapBytes(permissions);
+    usage.content += content.heapBytes();
+    usage.containers += children.capacity() * sizeof(std::unique_ptr<VFSNode>);
+    for (const auto& kv : childIndex)
+        usage.containers += indexNode + stringHeapBytes(kv.first);
+}
+
+void VFSNode::listChildren(bool showPermissions, std::ostream& out) const {
     for (const auto& child : children) {
         char typeChar = child->isDirectory() ? 'd' : '-';
         if (showPermissions) {
-            std::cout << typeChar << child->getPermissions() << "  " << child->getName() << "\n";
+            out << typeChar << child->getPermissions() << "  " << child->getName() << "\n";
         }
         else {
-            std::cout << child->getName() << "\n";
+            out << child->getName() << "\n";
         }
     }
 }
@@ -111,53 +201,107 @@ void VFSNode::listChildren(bool showPermissions) const {
 
 
 VirtualFileSystem::VirtualFileSystem(const std::string& saveFile)
-    : saveFileName(saveFile) {
+    : saveFileName(saveFile), store(saveFile + ".spill"), journal(saveFile + ".journal"),
+      deferredEvents(nullptr), unjournaled(false), journaling(false), console(&std::cout) {
     root = std::make_unique<VFSNode>("/", VFSNode::Type::Directory, nullptr);
     root->setPermissions("rwx");
     current = root.get();
+    addVolume(saveFile, root.get(), true);
+}
+
+void VirtualFileSystem::setConsole(std::ostream& out) {
+    console = &out;
+}
+
+std::ostream& VirtualFileSystem::getConsole() const {
+    return *console;
+}
+
+// status codes
+
+const char* statusMessage(VfsStatus status) {
+    switch (status) {
+    case VfsStatus::Ok: return "ok";
+    case VfsStatus::NotFound: return "no such file or directory";
+    case VfsStatus::NotADirectory: return "not a directory";
+    case VfsStatus::NotAFile: return "not a file";
+    case VfsStatus::AlreadyExists: return "already exists";
+    case VfsStatus::PermissionDenied: return "permission denied";
+    case VfsStatus::InvalidArgument: return "invalid argument";
+    case VfsStatus::NotEmpty: return "directory not empty (use -r)";
+    case VfsStatus::IsRoot: return "cannot modify root";
+    case VfsStatus::IoError: return "i/o error";
+    case VfsStatus::Busy: return "mount point busy";
+    }
+    return "unknown error";
+}
+
+namespace {
+
+//shell-side wording for a failed call
+bool report(std::ostream& out, const char* cmd, VfsStatus status) {
+    if (status == VfsStatus::Ok)
+        return true;
+
+    if (status == VfsStatus::PermissionDenied)
+        out << "Permission denied.\n";
+    else
+        out << cmd << ": " << statusMessage(status) << "\n";
+    return false;
+}
+
+bool isInside(const VFSNode* node, const VFSNode* ancestor) {
+    for (; node; node = node->getParent()) {
+        if (node == ancestor)
+            return true;
+    }
+    return false;
+}
+
 }
 
 // Path utilities
 
 std::vector<std::string> VirtualFileSystem::splitPath(const std::string& path) const {
     std::vector<std::string> result;
-    std::stringstream ss(path);
-    std::string item;
+    size_t start = 0;
+
+    while (start <= path.size()) {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos) slash = path.size();
 
-    while (std::getline(ss, item, '/')) {
-        if (!item.empty() && item != ".")
-            result.push_back(item);
+        if (slash > start && !(slash - start == 1 && path[start] == '.'))
+            result.emplace_back(path, start, slash - start);
+        start = slash + 1;
     }
     return result;
 }
 
-VFSNode* VirtualFileSystem::resolvePath(const std::string& path) {
-    if (path.empty()) return current;
-
-    VFSNode* node = (path[0] == '/') ? root.get() : current;
-    auto parts = splitPath(path);
+VFSNode* VirtualFileSystem::resolvePath(std::string_view path) {
+    return const_cast<VFSNode*>(resolvePathConst(path));
+}
 
-    for (const auto& part : parts) {
-        if (part == "..") {
-            if (node->getParent())
-                node = node->getParent();
-        }
-        else {
-            VFSNode* next = node->findChild(part);
-            if (!next) return nullptr;
-            node = next;
-        }
-    }
-    return node;
+const VFSNode* VirtualFileSystem::resolvePathConst(std::string_view path) const {
+    bool unloaded = false;
+    return walkPath(path, true, unloaded);
 }
 
-const VFSNode* VirtualFileSystem::resolvePathConst(const std::string& path) const {
+const VFSNode* VirtualFileSystem::walkPath(std::string_view path, bool loadVolumes, bool& unloaded) const {
     if (path.empty()) return current;
 
+    //walks the components in place; no temporary strings
     const VFSNode* node = (path[0] == '/') ? root.get() : current;
-    auto parts = splitPath(path);
+    size_t start = 0;
+
+    while (start <= path.size()) {
+        size_t slash = path.find('/', start);
+        if (slash == std::string_view::npos) slash = path.size();
+        std::string_view part = path.substr(start, slash - start);
+        start = slash + 1;
+
+        if (part.empty() || part == ".")
+            continue;
 
-    for (const auto& part : parts) {
         if (part == "..") {
             if (node->getParent())
                 node = node->getParent();
@@ -166,18 +310,56 @@ const VFSNode* VirtualFileSystem::resolvePathConst(const std::string& path) cons
             const VFSNode* next = node->findChildConst(part);
             if (!next) return nullptr;
             node = next;
+
+            //crossing into a volume that has not been read yet
+            Volume* vol = node->getVolume();
+            if (vol && !vol->loaded) {
+                if (!loadVolumes) {
+                    unloaded = true;
+                    return nullptr;
+                }
+                loadVolume(*vol);
+            }
         }
     }
     return node;
 }
 
+bool VirtualFileSystem::needsLoad(std::string_view path) const {
+    bool unloaded = false;
+    walkPath(path, false, unloaded);
+    return unloaded;
+}
+
+VfsStatus VirtualFileSystem::resolveParent(std::string_view path, VFSNode*& parent, std::string_view& name) {
+    if (path.empty())
+        return VfsStatus::InvalidArgument;
+
+    size_t slash = path.find_last_of('/');
+    std::string_view parentPath = (slash == std::string_view::npos) ? "" : path.substr(0, slash == 0 ? 1 : slash);
+    name = (slash == std::string_view::npos) ? path : path.substr(slash + 1);
+
+    if (name.empty() || name == "." || name == "..")
+        return VfsStatus::InvalidArgument;
+
+    parent = parentPath.empty() ? current : resolvePath(parentPath);
+    if (!parent)
+        return VfsStatus::NotFound;
+    if (!parent->isDirectory())
+        return VfsStatus::NotADirectory;
+    return VfsStatus::Ok;
+}
+
 bool VirtualFileSystem::checkPermission(const VFSNode* node, char need) const {
     return node->getPermissions().find(need) != std::string::npos;
 }
 
 std::string VirtualFileSystem::getCurrentPath() const {
+    return pathOf(current);
+}
+
+std::string VirtualFileSystem::pathOf(const VFSNode* node) const {
     std::vector<std::string> parts;
-    const VFSNode* node = current;
 
     while (node && node != root.get()) {
         parts.push_back(node->getName());
@@ -193,196 +375,192 @@ std::string VirtualFileSystem::getCurrentPath() const {
     return result;
 }
 
-// basic commands
+std::string VirtualFileSystem::absolutePath(const std::string& path) const {
+    if (!path.empty() && path[0] == '/')
+        return path;
 
-void VirtualFileSystem::cmdPwd() const {
-    std::cout << getCurrentPath() << "\n";
+    std::string base = getCurrentPath();
+    if (base != "/")
+        base += "/";
+    return base + path;
 }
 
-void VirtualFileSystem::cmdLs() const {
-    if (!checkPermission(current, 'r')) {
-        std::cout << "Permission denied.\n";
-        return;
-    }
-    current->listChildren(true);
+// library API
+
+VfsStatus VirtualFileSystem::lookup(std::string_view path, const VFSNode*& out) const {
+    out = resolvePathConst(path);
+    return out ? VfsStatus::Ok : VfsStatus::NotFound;
 }
 
-bool VirtualFileSystem::cmdCd(const std::string& path) {
+VfsStatus VirtualFileSystem::changeDirectory(std::string_view path) {
     if (path.empty()) {
         current = root.get();
-        return true;
+        return VfsStatus::Ok;
     }
 
     VFSNode* target = resolvePath(path);
-    if (!target) {
-        std::cout << "cd: no such directory\n";
-        return false;
-    }
-    if (!target->isDirectory()) {
-        std::cout << "cd: not a directory\n";
-        return false;
-    }
-    if (!checkPermission(target, 'x')) {
-        std::cout << "Permission denied.\n";
-        return false;
-    }
+    if (!target) return VfsStatus::NotFound;
+    if (!target->isDirectory()) return VfsStatus::NotADirectory;
+    if (!checkPermission(target, 'x')) return VfsStatus::PermissionDenied;
 
     current = target;
-    return true;
+    return VfsStatus::Ok;
 }
 
-bool VirtualFileSystem::cmdMkdir(const std::string& path) {
-    if (path.empty()) {
-        std::cout << "mkdir: missing operand\n";
-        return false;
-    }
-
-    size_t slash = path.find_last_of('/');
-    std::string parentPath = (slash == std::string::npos) ? "" : path.substr(0, slash);
-    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
-
-    VFSNode* parent = parentPath.empty() ? current : resolvePath(parentPath);
-    if (!parent || !parent->isDirectory()) {
-        std::cout << "mkdir: invalid parent directory\n";
-        return false;
-    }
-
-    if (parent->findChild(name)) {
-        std::cout << "mkdir: already exists\n";
-        return false;
-    }
+VfsStatus VirtualFileSystem::makeDirectory(std::string_view path) {
+    VFSNode* parent = nullptr;
+    std::string_view name;
+    VfsStatus st = resolveParent(path, parent, name);
+    if (st != VfsStatus::Ok) return st;
 
-    if (!checkPermission(parent, 'w')) {
-        std::cout << "Permission denied.\n";
-        return false;
-    }
+    if (parent->findChild(name)) return VfsStatus::AlreadyExists;
+    if (!checkPermission(parent, 'w')) return VfsStatus::PermissionDenied;
 
-    VFSNode* dir = parent->addDirectory(name);
+    VFSNode* dir = parent->addDirectory(std::string(name));
     dir->setPermissions("rwx");
-    return true;
+    markDirty(parent);
+    notify(VfsEvent::Kind::Create, dir);
+    return VfsStatus::Ok;
 }
 
-bool VirtualFileSystem::cmdTouch(const std::string& path) {
-    if (path.empty()) {
-        std::cout << "touch: missing operand\n";
-        return false;
-    }
-
-    size_t slash = path.find_last_of('/');
-    std::string parentPath = (slash == std::string::npos) ? "" : path.substr(0, slash);
-    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
-
-    VFSNode* parent = parentPath.empty() ? current : resolvePath(parentPath);
-    if (!parent || !parent->isDirectory()) {
-        std::cout << "touch: invalid directory\n";
-        return false;
-    }
+VfsStatus VirtualFileSystem::createFile(std::string_view path) {
+    VFSNode* parent = nullptr;
+    std::string_view name;
+    VfsStatus st = resolveParent(path, parent, name);
+    if (st != VfsStatus::Ok) return st;
 
-    if (parent->findChild(name))
-        return true; 
-
-    if (!checkPermission(parent, 'w')) {
-        std::cout << "Permission denied.\n";
-        return false;
-    }
+    //touching an existing entry is not an error
+    if (parent->findChild(name)) return VfsStatus::Ok;
+    if (!checkPermission(parent, 'w')) return VfsStatus::PermissionDenied;
 
-    VFSNode* file = parent->addFile(name);
+    VFSNode* file = parent->addFile(std::string(name));
     file->setPermissions("rw-");
-    return true;
+    markDirty(parent);
+    notify(VfsEvent::Kind::Create, file);
+    return VfsStatus::Ok;
 }
 
-bool VirtualFileSystem::cmdRm(const std::string& path, bool recursive) {
-    if (path.empty()) {
-        std::cout << "rm: missing operand\n";
-        return false;
-    }
+VfsStatus VirtualFileSystem::findRemovable(std::string_view path, bool recursive, VFSNode*& target) {
+    if (path == "/") return VfsStatus::IsRoot;
 
-    if (path == "/") {
-        std::cout << "rm: cannot remove root\n";
-        return false;
-    }
+    VFSNode* parent = nullptr;
+    std::string_view name;
+    VfsStatus st = resolveParent(path, parent, name);
+    if (st != VfsStatus::Ok) return st;
 
-    size_t slash = path.find_last_of('/');
-    std::string parentPath = (slash == std::string::npos) ? "" : path.substr(0, slash);
-    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    target = parent->findChild(name);
+    if (!target) return VfsStatus::NotFound;
+    if (!checkPermission(parent, 'w')) return VfsStatus::PermissionDenied;
 
-    VFSNode* parent = parentPath.empty() ? current : resolvePath(parentPath);
-    if (!parent || !parent->isDirectory()) {
-        std::cout << "rm: invalid parent\n";
-        return false;
-    }
+    if (hasMountInside(target)) return VfsStatus::Busy;
+    if (target->isDirectory() && !recursive && !target->getChildrenConst().empty())
+        return VfsStatus::NotEmpty;
+    return VfsStatus::Ok;
+}
 
-    VFSNode* target = parent->findChild(name);
-    if (!target) {
-        std::cout << "rm: not found\n";
-        return false;
-    }
+VfsStatus VirtualFileSystem::remove(std::string_view path, bool recursive) {
+    VFSNode* target = nullptr;
+    VfsStatus st = findRemovable(path, recursive, target);
+    if (st != VfsStatus::Ok) return st;
 
-    if (!checkPermission(parent, 'w')) {
-        std::cout << "Permission denied.\n";
-        return false;
-    }
+    //never leave the working directory pointing into a freed subtree
+    VFSNode* parent = target->getParent();
+    if (isInside(current, target))
+        current = parent;
 
-    if (target->isDirectory() && !recursive && !target->getChildrenConst().empty()) {
-        std::cout << "rm: directory not empty (use -r)\n";
-        return false;
-    }
+    markDirty(parent);
+    notify(VfsEvent::Kind::Remove, target);
+    parent->removeChild(target->getName());
+    return VfsStatus::Ok;
+}
 
-    parent->removeChild(name);
-    return true;
+VfsStatus VirtualFileSystem::readFile(std::string_view path, std::string_view& out) {
+    VFSNode* node = resolvePath(path);
+    if (!node) return VfsStatus::NotFound;
+    if (!node->isFile()) return VfsStatus::NotAFile;
+    if (!checkPermission(node, 'r')) return VfsStatus::PermissionDenied;
+
+    //joining the pieces rebuilds the rope, so this is not a const read
+    store.touch(node);
+    out = node->getContent().flatten();
+    return VfsStatus::Ok;
 }
 
-// file viweing / editing
+VfsStatus VirtualFileSystem::readFile(std::string_view path, std::vector<std::string_view>& out) const {
+    const VFSNode* node = resolvePathConst(path);
+    if (!node) return VfsStatus::NotFound;
+    if (!node->isFile()) return VfsStatus::NotAFile;
+    if (!checkPermission(node, 'r')) return VfsStatus::PermissionDenied;
 
-bool VirtualFileSystem::cmdCat(const std::string& path) const {
+    store.touch(node);
+    node->getContentConst().pieces(out);
+    return VfsStatus::Ok;
+}
+
+VfsStatus VirtualFileSystem::streamFile(std::string_view path,
+    const std::function<void(const char*, size_t)>& sink) const {
     const VFSNode* node = resolvePathConst(path);
-    if (!node || !node->isFile()) {
-        std::cout << "cat: invalid file\n";
-        return false;
-    }
+    if (!node) return VfsStatus::NotFound;
+    if (!node->isFile()) return VfsStatus::NotAFile;
+    if (!checkPermission(node, 'r')) return VfsStatus::PermissionDenied;
 
-    if (!checkPermission(node, 'r')) {
-        std::cout << "Permission denied.\n";
-        return false;
-    }
+    return store.readChunks(node, sink) ? VfsStatus::Ok : VfsStatus::IoError;
+}
 
-    std::cout << node->getContentConst() << "\n";
-    return true;
+VfsStatus VirtualFileSystem::writeFile(std::string_view path, std::string_view data) {
+    return writeFile(path, std::vector<std::string_view>{ data }, false);
 }
 
-bool VirtualFileSystem::cmdWrite(const std::string& path) {
+VfsStatus VirtualFileSystem::writeFile(std::string_view path,
+    const std::vector<std::string_view>& segments, bool append) {
     VFSNode* node = resolvePath(path);
 
     if (!node) {
-        if (!cmdTouch(path)) return false;
+        VfsStatus st = createFile(path);
+        if (st != VfsStatus::Ok) return st;
         node = resolvePath(path);
     }
 
-    if (!node->isFile()) {
-        std::cout << "write: not a file\n";
-        return false;
-    }
-
-    if (!checkPermission(node, 'w')) {
-        std::cout << "Permission denied.\n";
-        return false;
-    }
+    if (!node->isFile()) return VfsStatus::NotAFile;
+    if (!checkPermission(node, 'w')) return VfsStatus::PermissionDenied;
 
-    std::cout << "Enter text. End with .end\n";
-    std::string line;
-    std::ostringstream buffer;
+    //segments may point into the target itself, so they are gathered
+    //before it changes
+    Rope added;
+    for (const auto& seg : segments)
+        added.append(seg);
 
-    while (true) {
-        std::getline(std::cin, line);
-        if (line == ".end") break;
-        buffer << line << "\n";
+    Rope& body = node->getContent();
+    if (append) {
+        store.touch(node);
+        body.append(std::move(added));
+        store.touch(node);
     }
-
-    node->getContent() = buffer.str();
-    return true;
+    else {
+        body = std::move(added);
+        store.replaced(node);
+    }
+    markDirty(node);
+    notify(VfsEvent::Kind::Write, node);
+    return VfsStatus::Ok;
 }
 
-//copy/move
+VfsStatus VirtualFileSystem::insertFile(std::string_view path, size_t offset, std::string_view data) {
+    VFSNode* node = resolvePath(path);
+    if (!node) return VfsStatus::NotFound;
+    if (!node->isFile()) return VfsStatus::NotAFile;
+    if (!checkPermission(node, 'w')) return VfsStatus::PermissionDenied;
+
+    store.touch(node);
+    Rope& body = node->getContent();
+    if (offset > body.size()) return VfsStatus::InvalidArgument;
+
+    body.insert(offset, data);
+    store.touch(node);
+    markDirty(node);
+    notify(VfsEvent::Kind::Write, node);
+    return VfsStatus::Ok;
+}
 
 void VirtualFileSystem::copyNodeRecursive(const VFSNode* src, VFSNode* dst, const std::string& newName) {
     VFSNode* newNode = nullptr;
@@ -392,7 +570,9 @@ void VirtualFileSystem::copyNodeRecursive(const VFSNode* src, VFSNode* dst, cons
     }
     else {
         newNode = dst->addFile(newName);
+        store.touch(src);
         newNode->getContent() = src->getContentConst();
+        store.replaced(newNode);
     }
 
     newNode->setPermissions(src->getPermissions());
@@ -404,164 +584,1351 @@ void VirtualFileSystem::copyNodeRecursive(const VFSNode* src, VFSNode* dst, cons
     }
 }
 
-bool VirtualFileSystem::cmdCp(const std::string& srcPath, const std::string& dstPath) {
+VfsStatus VirtualFileSystem::copy(std::string_view srcPath, std::string_view dstPath) {
     const VFSNode* src = resolvePathConst(srcPath);
-    if (!src) {
-        std::cout << "cp: invalid source\n";
-        return false;
-    }
-
-    if (!checkPermission(src, 'r')) {
-        std::cout << "Permission denied.\n";
-        return false;
-    }
+    if (!src) return VfsStatus::NotFound;
+    if (!checkPermission(src, 'r')) return VfsStatus::PermissionDenied;
 
-    size_t slash = dstPath.find_last_of('/');
-    std::string parentPath = (slash == std::string::npos) ? "" : dstPath.substr(0, slash);
-    std::string name = (slash == std::string::npos) ? dstPath : dstPath.substr(slash + 1);
+    VFSNode* parent = nullptr;
+    std::string_view name;
+    VfsStatus st = resolveParent(dstPath, parent, name);
+    if (st != VfsStatus::Ok) return st;
 
-    VFSNode* parent = parentPath.empty() ? current : resolvePath(parentPath);
-    if (!parent || !parent->isDirectory()) {
-        std::cout << "cp: invalid target\n";
-        return false;
-    }
+    if (parent->findChild(name)) return VfsStatus::AlreadyExists;
 
-    if (parent->findChild(name)) {
-        std::cout << "cp: target exists\n";
-        return false;
-    }
+    //a directory copied into itself would never stop growing
+    if (isInside(parent, src)) return VfsStatus::InvalidArgument;
 
-    copyNodeRecursive(src, parent, name);
-    return true;
+    loadVolumesUnder(src);
+    copyNodeRecursive(src, parent, std::string(name));
+    markDirty(parent);
+    if (events.active())
+        notify(VfsEvent::Kind::Copy, pathOf(src), pathOf(parent->findChild(name)));
+    return VfsStatus::Ok;
 }
 
-bool VirtualFileSystem::cmdMv(const std::string& srcPath, const std::string& dstPath) {
-    const VFSNode* srcConst = resolvePathConst(srcPath);
-    if (!srcConst) {
-        std::cout << "mv: invalid source\n";
-        return false;
-    }
-
+VfsStatus VirtualFileSystem::move(std::string_view srcPath, std::string_view dstPath) {
     VFSNode* src = resolvePath(srcPath);
-    VFSNode* oldParent = src->getParent();
+    if (!src) return VfsStatus::NotFound;
 
-    if (!oldParent) {
-        std::cout << "mv: cannot move root\n";
-        return false;
-    }
+    VFSNode* oldParent = src->getParent();
+    if (!oldParent) return VfsStatus::IsRoot;
 
-    size_t slash = dstPath.find_last_of('/');
-    std::string parentPath = (slash == std::string::npos) ? "" : dstPath.substr(0, slash);
-    std::string name = (slash == std::string::npos) ? dstPath : dstPath.substr(slash + 1);
+    VFSNode* parent = nullptr;
+    std::string_view name;
+    VfsStatus st = resolveParent(dstPath, parent, name);
+    if (st != VfsStatus::Ok) return st;
 
-    VFSNode* parent = parentPath.empty() ? current : resolvePath(parentPath);
-    if (!parent || !parent->isDirectory()) {
-        std::cout << "mv: invalid target\n";
-        return false;
-    }
+    if (parent->findChild(name)) return VfsStatus::AlreadyExists;
+    if (isInside(parent, src)) return VfsStatus::InvalidArgument;
 
-    if (parent->findChild(name)) {
-        std::cout << "mv: target exists\n";
-        return false;
-    }
+    std::string from = events.active() ? pathOf(src) : std::string();
 
-    copyNodeRecursive(src, parent, name);
-    oldParent->removeChild(src->getName());
+    //relink the node itself; bodies are never copied and the cwd stays valid
+    std::unique_ptr<VFSNode> moved = oldParent->detachChild(src->getName());
+    moved->setName(std::string(name));
+    VFSNode* to = parent->adoptChild(std::move(moved));
+    markDirty(oldParent);
+    markDirty(parent);
 
-    return true;
+    if (!from.empty())
+        notify(VfsEvent::Kind::Move, from, pathOf(to));
+    return VfsStatus::Ok;
 }
 
-//chmod
-
-bool VirtualFileSystem::cmdChmod(const std::string& perms, const std::string& path) {
-    if (perms.size() != 3) {
-        std::cout << "chmod: invalid permissions\n";
-        return false;
-    }
+VfsStatus VirtualFileSystem::changeMode(std::string_view perms, std::string_view path) {
+    if (perms.size() != 3) return VfsStatus::InvalidArgument;
 
     VFSNode* n = resolvePath(path);
-    if (!n) {
-        std::cout << "chmod: no such file\n";
-        return false;
-    }
+    if (!n) return VfsStatus::NotFound;
 
-    n->setPermissions(perms);
-    return true;
+    n->setPermissions(std::string(perms));
+    markDirty(n);
+    notify(VfsEvent::Kind::Chmod, n);
+    return VfsStatus::Ok;
 }
 
-// tree printnter
+EventStream& VirtualFileSystem::eventStream() {
+    return events;
+}
 
-void VirtualFileSystem::cmdTree() const {
-    struct Helper {
-        static void print(const VFSNode* node, const std::string& prefix, bool last, const VFSNode* root) {
-            std::cout << prefix;
+void VirtualFileSystem::notify(VfsEvent::Kind kind, const VFSNode* node) {
+    if (events.active())
+        notify(kind, pathOf(node), std::string());
+}
 
-            if (node != root)
-                std::cout << (last ? "`-- " : "|-- ");
+void VirtualFileSystem::notify(VfsEvent::Kind kind, const std::string& path, const std::string& target) {
+    if (!events.active())
+        return;
 
-            if (node == root)
-                std::cout << "/\n";
-            else
-                std::cout << node->getName() << "\n";
+    //a transaction only reports what it changed once every step has applied
+    if (deferredEvents)
+        deferredEvents->push_back(VfsEvent{ kind, path, target, 0, false });
+    else
+        events.publish(kind, path, target);
+}
 
-            const auto& kids = node->getChildrenConst();
-            for (size_t i = 0; i < kids.size(); ++i) {
-                bool childLast = (i == kids.size() - 1);
-                std::string newPrefix = prefix;
-                if (node != root)
-                    newPrefix += (last ? "    " : "|   ");
+VfsStatus VirtualFileSystem::listPage(std::string_view path, const std::string& cursor, size_t limit,
+    std::vector<const VFSNode*>& out, std::string& next) const {
+    const VFSNode* dir = resolvePathConst(path);
+    if (!dir) return VfsStatus::NotFound;
+    if (!dir->isDirectory()) return VfsStatus::NotADirectory;
+    if (!checkPermission(dir, 'r')) return VfsStatus::PermissionDenied;
+    if (limit == 0) return VfsStatus::InvalidArgument;
 
-                print(kids[i].get(), newPrefix, childLast, root);
-            }
-        }
-    };
+    next = dir->listPage(cursor, limit, out);
+    return VfsStatus::Ok;
+}
+
+// basic commands
 
-    Helper::print(root.get(), "", true, root.get());
+void VirtualFileSystem::cmdPwd() const {
+    cmdPwd(*console);
 }
 
-//save/load
+void VirtualFileSystem::cmdPwd(std::ostream& out) const {
+    out << getCurrentPath() << "\n";
+}
 
-void VirtualFileSystem::saveNodeRecursive(const VFSNode* node, const std::string& path, std::ostream& out) const {
-    std::string fullPath = path;
+void VirtualFileSystem::cmdLs() const {
+    cmdLs(*console);
+}
 
-    if (node != root.get()) {
-        if (fullPath != "/")
-            fullPath += "/";
-        fullPath += node->getName();
-    }
+void VirtualFileSystem::cmdLs(std::ostream& out) const {
+    VfsStatus st = visitDirectory("", [&](const VFSNode& child) {
+        char typeChar = child.isDirectory() ? 'd' : '-';
+        out << typeChar << child.getPermissions() << "  " << child.getName() << "\n";
+    });
+    report(*console, "ls", st);
+}
 
-    out << "NODE " << (node->isDirectory() ? "DIR " : "FILE ")
-        << node->getPermissions() << " " << fullPath << "\n";
+bool VirtualFileSystem::cmdLsPage(const std::string& cursor, size_t count) const {
+    std::vector<const VFSNode*> page;
+    std::string next;
+    if (!report(*console, "ls", listPage("", cursor, count, page, next)))
+        return false;
 
-    if (node->isFile()) {
-        out << "CONTENT_BEGIN\n";
-        out << node->getContentConst();
-        out << "CONTENT_END\n";
+    for (const VFSNode* child : page) {
+        char typeChar = child->isDirectory() ? 'd' : '-';
+        *console << typeChar << child->getPermissions() << "  " << child->getName() << "\n";
     }
+    if (!next.empty())
+        *console << "-- more: ls -p " << count << " " << next << "\n";
+    return true;
+}
 
-    for (const auto& child : node->getChildrenConst()) {
-        saveNodeRecursive(child.get(), fullPath, out);
-    }
+bool VirtualFileSystem::cmdCd(const std::string& path) {
+    return report(*console, "cd", changeDirectory(path));
 }
 
-void VirtualFileSystem::save() const {
-    std::ofstream out(saveFileName);
-    if (!out) {
-        std::cout << "Could not save filesystem.\n";
-        return;
+bool VirtualFileSystem::cmdMkdir(const std::string& path) {
+    if (path.empty()) {
+        *console << "mkdir: missing operand\n";
+        return false;
+    }
+    return report(*console, "mkdir", makeDirectory(path));
+}
+
+bool VirtualFileSystem::cmdTouch(const std::string& path) {
+    if (path.empty()) {
+        *console << "touch: missing operand\n";
+        return false;
+    }
+    return report(*console, "touch", createFile(path));
+}
+
+bool VirtualFileSystem::cmdRm(const std::string& path, bool recursive) {
+    if (path.empty()) {
+        *console << "rm: missing operand\n";
+        return false;
+    }
+    return report(*console, "rm", remove(path, recursive));
+}
+
+// file viweing / editing
+
+bool VirtualFileSystem::cmdCat(const std::string& path) const {
+    std::vector<std::string_view> pieces;
+    if (!report(*console, "cat", readFile(path, pieces)))
+        return false;
+
+    for (std::string_view piece : pieces)
+        *console << piece;
+    *console << "\n";
+    return true;
+}
+
+std::string readTextBlock(std::istream& in, std::ostream& out) {
+    out << "Enter text. End with .end\n";
+    std::string line;
+    std::string text;
+
+    while (true) {
+        if (!std::getline(in, line)) break;
+        if (line == ".end") break;
+        text += line;
+        text += '\n';
+    }
+    return text;
+}
+
+
+bool VirtualFileSystem::cmdWrite(const std::string& path, std::istream& in) {
+    //check the target before asking for text
+    const VFSNode* node = resolvePathConst(path);
+    if (node && !node->isFile())
+        return report(*console, "write", VfsStatus::NotAFile);
+    if (node && !checkPermission(node, 'w'))
+        return report(*console, "write", VfsStatus::PermissionDenied);
+
+    return report(*console, "write", writeFile(path, readTextBlock(in, *console)));
+}
+
+bool VirtualFileSystem::cmdAppend(const std::string& path, const std::string& text, std::istream& in) {
+    if (path.empty()) {
+        *console << "append: missing operand\n";
+        return false;
+    }
+
+    const VFSNode* node = resolvePathConst(path);
+    if (node && !node->isFile())
+        return report(*console, "append", VfsStatus::NotAFile);
+    if (node && !checkPermission(node, 'w'))
+        return report(*console, "append", VfsStatus::PermissionDenied);
+
+    //text on the command line is one line; otherwise read a block
+    std::string added = text.empty() ? readTextBlock(in, *console) : text + "\n";
+    return report(*console, "append", writeFile(path, std::vector<std::string_view>{ added }, true));
+}
+
+bool VirtualFileSystem::cmdInsert(const std::string& path, size_t offset, const std::string& text, std::istream& in) {
+    const VFSNode* node = resolvePathConst(path);
+    if (!node)
+        return report(*console, "insert", VfsStatus::NotFound);
+    if (!node->isFile())
+        return report(*console, "insert", VfsStatus::NotAFile);
+    if (!checkPermission(node, 'w'))
+        return report(*console, "insert", VfsStatus::PermissionDenied);
+    if (offset > store.contentSize(node))
+        return report(*console, "insert", VfsStatus::InvalidArgument);
+
+    std::string added = text.empty() ? readTextBlock(in, *console) : text + "\n";
+    return report(*console, "insert", insertFile(path, offset, added));
+}
+
+void VirtualFileSystem::holdContent() {
+    store.hold();
+}
+
+void VirtualFileSystem::releaseContent() {
+    store.release();
+}
+
+//copy/move
+
+bool VirtualFileSystem::cmdCp(const std::string& srcPath, const std::string& dstPath) {
+    return report(*console, "cp", copy(srcPath, dstPath));
+}
+
+bool VirtualFileSystem::cmdMv(const std::string& srcPath, const std::string& dstPath) {
+    return report(*console, "mv", move(srcPath, dstPath));
+}
+
+//chmod
+
+bool VirtualFileSystem::cmdChmod(const std::string& perms, const std::string& path) {
+    return report(*console, "chmod", changeMode(perms, path));
+}
+
+//host import/export
+
+namespace {
+
+unsigned transferThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n < 2 ? 2 : n;
+}
+
+//one sized read per file instead of line-by-line streaming
+bool readHostFile(const fs::path& path, std::string& out) {
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec) return false;
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    out.resize(static_cast<size_t>(size));
+    if (size > 0)
+        in.read(&out[0], static_cast<std::streamsize>(size));
+    out.resize(static_cast<size_t>(in.gcount() > 0 ? in.gcount() : 0));
+    return true;
+}
+
+//a node name that would leave the directory it is written into, or mean
+//something else to the host (tar and import do not forbid these)
+bool unsafeHostName(const std::string& name) {
+    return name.empty() || name == "." || name == ".."
+        || name.find_first_of(std::string("/\\:\0", 4)) != std::string::npos;
+}
+
+bool writeHostFile(const fs::path& path, const VFSNode* node, const ContentStore& store) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    //spilled bodies are copied straight from the backing file
+    bool read = store.readChunks(node, [&](const char* data, size_t len) {
+        out.write(data, static_cast<std::streamsize>(len));
+    });
+    return read && static_cast<bool>(out);
+}
+
+//walks a host tree on a pool of threads, building a detached VFSNode subtree.
+//every worker owns the directory node it is filling, so no node is shared.
+class HostTreeWalker {
+private:
+    struct Job {
+        fs::path hostDir;
+        VFSNode* dir;
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Job> queue;
+    size_t pending = 0;
+
+    void worker() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&] { return !queue.empty() || pending == 0; });
+                if (queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            std::vector<Job> found;
+            std::error_code ec;
+            for (fs::directory_iterator it(job.hostDir, ec), end; !ec && it != end; it.increment(ec)) {
+                const fs::directory_entry& entry = *it;
+                std::string name = entry.path().filename().string();
+
+                std::error_code sec;
+                fs::file_status st = entry.symlink_status(sec);
+                if (sec || fs::is_symlink(st)) {
+                    ++skipped;
+                    continue;
+                }
+
+                if (fs::is_directory(st)) {
+                    VFSNode* d = job.dir->addDirectory(name);
+                    d->setPermissions("rwx");
+                    found.push_back({ entry.path(), d });
+                    ++directories;
+                }
+                else if (fs::is_regular_file(st)) {
+                    VFSNode* f = job.dir->addFile(name);
+                    f->setPermissions("rw-");
+                    std::string body;
+                    if (readHostFile(entry.path(), body)) {
+                        f->getContent().assign(std::move(body));
+                        ++files;
+                    }
+                    else {
+                        ++failed;
+                    }
+                }
+                else {
+                    ++skipped;
+                }
+            }
+            if (ec) ++failed;
+
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto& j : found)
+                queue.push_back(std::move(j));
+            pending += found.size();
+            --pending;
+            cv.notify_all();
+        }
+    }
+
+public:
+    std::atomic<size_t> directories{ 0 };
+    std::atomic<size_t> files{ 0 };
+    std::atomic<size_t> skipped{ 0 };
+    std::atomic<size_t> failed{ 0 };
+
+    void run(const fs::path& hostRoot, VFSNode* into) {
+        queue.push_back({ hostRoot, into });
+        pending = 1;
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 0; i < transferThreads(); ++i)
+            pool.emplace_back(&HostTreeWalker::worker, this);
+        for (auto& t : pool)
+            t.join();
+    }
+};
+
+}
+
+bool VirtualFileSystem::cmdImport(const std::string& hostDir, const std::string& vfsDir) {
+    std::error_code ec;
+    if (hostDir.empty() || !fs::is_directory(hostDir, ec)) {
+        *console << "import: invalid host directory\n";
+        return false;
+    }
+
+    VFSNode* target = resolvePath(vfsDir);
+    if (!target || !target->isDirectory()) {
+        *console << "import: invalid target directory\n";
+        return false;
+    }
+
+    if (!checkPermission(target, 'w')) {
+        *console << "Permission denied.\n";
+        return false;
+    }
+
+    //build off-tree, then splice the finished subtrees in
+    VFSNode staging("", VFSNode::Type::Directory, nullptr);
+    HostTreeWalker walker;
+    walker.run(hostDir, &staging);
+
+    std::function<void(const VFSNode*)> track = [&](const VFSNode* n) {
+        if (n->isFile())
+            store.replaced(n);
+        for (const auto& c : n->getChildrenConst())
+            track(c.get());
+    };
+
+    size_t collisions = 0;
+    for (auto& child : staging.releaseChildren()) {
+        if (target->findChild(child->getName())) {
+            *console << "import: " << child->getName() << " already exists, skipped\n";
+            ++collisions;
+            continue;
+        }
+        VFSNode* added = target->adoptChild(std::move(child));
+        markDirty(target);
+        notify(VfsEvent::Kind::Create, added);
+        track(added);
+    }
+
+    *console << "import: " << walker.directories << " directories, "
+        << walker.files << " files";
+    if (walker.skipped) *console << ", " << walker.skipped << " skipped";
+    if (walker.failed) *console << ", " << walker.failed << " unreadable";
+    *console << "\n";
+    return collisions == 0 && walker.failed == 0;
+}
+
+bool VirtualFileSystem::cmdExport(const std::string& vfsDir, const std::string& hostDir) const {
+    const VFSNode* src = resolvePathConst(vfsDir);
+    if (!src || !src->isDirectory()) {
+        *console << "export: invalid source directory\n";
+        return false;
+    }
+
+    if (!checkPermission(src, 'r')) {
+        *console << "Permission denied.\n";
+        return false;
+    }
+    loadVolumesUnder(src);
+
+    //directories are created up front so file writes can run in any order
+    struct FileJob {
+        const VFSNode* node;
+        fs::path hostPath;
+    };
+    std::vector<FileJob> jobs;
+    size_t directories = 0;
+    size_t skipped = 0;
+    bool ok = true;
+
+    std::function<void(const VFSNode*, const fs::path&)> walk =
+        [&](const VFSNode* dir, const fs::path& hostPath) {
+        std::error_code ec;
+        fs::create_directories(hostPath, ec);
+        if (ec) {
+            *console << "export: cannot create " << hostPath.string() << "\n";
+            ok = false;
+            return;
+        }
+        ++directories;
+
+        for (const auto& child : dir->getChildrenConst()) {
+            if (!checkPermission(child.get(), 'r')) {
+                ++skipped;
+                continue;
+            }
+            if (unsafeHostName(child->getName())) {
+                *console << "export: unsafe name " << pathOf(child.get()) << ", skipped\n";
+                ++skipped;
+                continue;
+            }
+            if (child->isDirectory())
+                walk(child.get(), hostPath / child->getName());
+            else
+                jobs.push_back({ child.get(), hostPath / child->getName() });
+        }
+    };
+    walk(src, hostDir);
+
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> failed{ 0 };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < transferThreads(); ++i) {
+        pool.emplace_back([&] {
+            for (size_t j = next++; j < jobs.size(); j = next++) {
+                if (!writeHostFile(jobs[j].hostPath, jobs[j].node, store))
+                    ++failed;
+            }
+        });
+    }
+    for (auto& t : pool)
+        t.join();
+
+    *console << "export: " << directories << " directories, "
+        << (jobs.size() - failed) << " files";
+    if (skipped) *console << ", " << skipped << " skipped";
+    if (failed) *console << ", " << failed << " failed";
+    *console << "\n";
+    return ok && failed == 0;
+}
+
+//tar archives
+
+namespace {
+
+const size_t TAR_IO_BUFFER = 64 * 1024;
+
+}
+
+bool VirtualFileSystem::cmdTarCreate(const std::string& archive, const std::string& vfsDir) const {
+    const VFSNode* src = resolvePathConst(vfsDir);
+    if (!src || !src->isDirectory()) {
+        *console << "tar: invalid source directory\n";
+        return false;
+    }
+
+    if (!checkPermission(src, 'r')) {
+        *console << "Permission denied.\n";
+        return false;
+    }
+    loadVolumesUnder(src);
+
+    std::vector<char> ioBuffer(TAR_IO_BUFFER);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(ioBuffer.data(), static_cast<std::streamsize>(ioBuffer.size()));
+    out.open(archive, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        *console << "tar: cannot create archive\n";
+        return false;
+    }
+
+    TarWriter writer(out);
+    size_t directories = 0;
+    size_t files = 0;
+    size_t skipped = 0;
+
+    std::function<void(const VFSNode*, const std::string&)> walk =
+        [&](const VFSNode* dir, const std::string& prefix) {
+        for (const auto& child : dir->getChildrenConst()) {
+            if (!writer.good()) return;
+            if (!checkPermission(child.get(), 'r')) {
+                ++skipped;
+                continue;
+            }
+
+            std::string path = prefix + child->getName();
+            unsigned mode = tarModeFromPermissions(child->getPermissions(), child->isDirectory());
+
+            if (child->isDirectory()) {
+                writer.addDirectory(path, mode);
+                ++directories;
+                walk(child.get(), path + "/");
+            }
+            else {
+                writer.beginFile(path, mode, store.contentSize(child.get()));
+                store.readChunks(child.get(), [&](const char* data, size_t len) {
+                    writer.write(data, len);
+                });
+                writer.endFile();
+                ++files;
+            }
+        }
+    };
+    walk(src, "");
+    writer.finish();
+
+    if (!writer.good()) {
+        *console << "tar: write failed\n";
+        return false;
+    }
+
+    *console << "tar: " << directories << " directories, " << files << " files";
+    if (skipped) *console << ", " << skipped << " skipped";
+    *console << "\n";
+    return true;
+}
+
+bool VirtualFileSystem::cmdTarExtract(const std::string& archive, const std::string& vfsDir) {
+    VFSNode* target = resolvePath(vfsDir);
+    if (!target || !target->isDirectory()) {
+        *console << "tar: invalid target directory\n";
+        return false;
+    }
+
+    if (!checkPermission(target, 'w')) {
+        *console << "Permission denied.\n";
+        return false;
+    }
+
+    std::vector<char> ioBuffer(TAR_IO_BUFFER);
+    std::ifstream in;
+    in.rdbuf()->pubsetbuf(ioBuffer.data(), static_cast<std::streamsize>(ioBuffer.size()));
+    in.open(archive, std::ios::binary);
+    if (!in) {
+        *console << "tar: cannot open archive\n";
+        return false;
+    }
+
+    TarReader reader(in);
+    TarReader::Entry entry;
+    size_t directories = 0;
+    size_t files = 0;
+    size_t skipped = 0;
+    size_t denied = 0;
+
+    //directory modes are applied once everything is in, like tar does, so
+    //a read-only directory in the archive can still receive its files
+    std::vector<std::pair<VFSNode*, std::string>> dirModes;
+
+    while (reader.next(entry)) {
+        auto parts = splitPath(entry.path);
+        if (parts.empty() && entry.type == '5')
+            continue; //"./" names the target itself
+
+        bool escapes = std::find(parts.begin(), parts.end(), "..") != parts.end();
+        if (parts.empty() || escapes || (entry.type != '0' && entry.type != '5')) {
+            ++skipped;
+            continue;
+        }
+
+        //create missing parents on the way down
+        bool isDir = entry.type == '5';
+        size_t dirParts = isDir ? parts.size() : parts.size() - 1;
+        VFSNode* dir = target;
+        bool allowed = true;
+        for (size_t i = 0; i < dirParts && dir; ++i) {
+            VFSNode* child = dir->findChild(parts[i]);
+            if (!child) {
+                //same rule as makeDirectory
+                if (!checkPermission(dir, 'w')) {
+                    allowed = false;
+                    break;
+                }
+                child = dir->addDirectory(parts[i]);
+                child->setPermissions("rwx");
+                markDirty(dir);
+                notify(VfsEvent::Kind::Create, child);
+            }
+            else if (child->getVolume() && !child->getVolume()->loaded) {
+                loadVolume(*child->getVolume());
+            }
+            dir = child->isDirectory() ? child : nullptr;
+        }
+
+        if (!allowed) {
+            ++denied;
+            continue;
+        }
+        if (!dir) {
+            ++skipped;
+            continue;
+        }
+
+        if (isDir) {
+            //changing a directory's mode needs write access to its parent
+            if (dir != target && !checkPermission(dir->getParent(), 'w')) {
+                ++denied;
+                continue;
+            }
+            dirModes.emplace_back(dir, tarPermissionsFromMode(entry.mode));
+            ++directories;
+            continue;
+        }
+
+        VFSNode* file = dir->findChild(parts.back());
+        if (file && !file->isFile()) {
+            ++skipped;
+            continue;
+        }
+        //same rules as createFile and writeFile
+        if (file ? !checkPermission(file, 'w') : !checkPermission(dir, 'w')) {
+            ++denied;
+            continue;
+        }
+        if (!file) {
+            file = dir->addFile(parts.back());
+            notify(VfsEvent::Kind::Create, file);
+        }
+
+        file->setPermissions(tarPermissionsFromMode(entry.mode));
+        std::string body;
+        bool complete = reader.readData(body);
+        file->getContent().assign(std::move(body));
+        store.replaced(file);
+        markDirty(dir);
+        notify(VfsEvent::Kind::Write, file);
+        if (!complete)
+            break;
+        ++files;
+    }
+
+    for (auto it = dirModes.rbegin(); it != dirModes.rend(); ++it) {
+        it->first->setPermissions(it->second);
+        markDirty(it->first);
+        notify(VfsEvent::Kind::Chmod, it->first);
+    }
+
+    *console << "tar: " << directories << " directories, " << files << " files";
+    if (skipped) *console << ", " << skipped << " skipped";
+    if (denied) *console << ", " << denied << " denied";
+    *console << "\n";
+
+    if (!reader.error().empty()) {
+        *console << "tar: " << reader.error() << "\n";
+        return false;
+    }
+    return true;
+}
+
+//wildcards
+
+namespace {
+
+//a [...] class starting at pat[p]. end is set just past the closing
+//bracket, or to npos when there is none and the [ is an ordinary character
+bool matchClass(std::string_view pat, size_t p, char ch, size_t& end) {
+    size_t i = p + 1;
+    bool negate = i < pat.size() && (pat[i] == '!' || pat[i] == '^');
+    if (negate) ++i;
+
+    bool found = false;
+    bool first = true; //a leading ] is a member, not the end
+    while (i < pat.size() && (first || pat[i] != ']')) {
+        first = false;
+        if (i + 2 < pat.size() && pat[i + 1] == '-' && pat[i + 2] != ']') {
+            if (pat[i] <= ch && ch <= pat[i + 2]) found = true;
+            i += 3;
+        }
+        else {
+            if (pat[i] == ch) found = true;
+            ++i;
+        }
+    }
+
+    if (i >= pat.size()) {
+        end = std::string_view::npos;
+        return false;
+    }
+    end = i + 1;
+    return found != negate;
+}
+
+}
+
+bool hasGlobChars(std::string_view s) {
+    return s.find_first_of("*?[") != std::string_view::npos;
+}
+
+bool globMatch(std::string_view pattern, std::string_view name) {
+    //greedy with backtracking to the last *, so no recursion
+    size_t p = 0, n = 0;
+    size_t star = std::string_view::npos, starName = 0;
+
+    while (n < name.size()) {
+        if (p < pattern.size()) {
+            char c = pattern[p];
+            if (c == '*') {
+                star = p++;
+                starName = n;
+                continue;
+            }
+
+            size_t next = p + 1;
+            bool step;
+            if (c == '?') {
+                step = true;
+            }
+            else if (c == '[') {
+                size_t end;
+                bool hit = matchClass(pattern, p, name[n], end);
+                if (end == std::string_view::npos) {
+                    step = name[n] == '[';
+                }
+                else {
+                    step = hit;
+                    next = end;
+                }
+            }
+            else {
+                step = c == name[n];
+            }
+
+            if (step) {
+                p = next;
+                ++n;
+                continue;
+            }
+        }
+
+        if (star == std::string_view::npos)
+            return false;
+        p = star + 1;
+        n = ++starName;
+    }
+
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
+
+VfsStatus VirtualFileSystem::expandGlob(std::string_view pattern, std::vector<std::string>& out) const {
+    struct Match {
+        const VFSNode* node;
+        std::string path; //as the caller spelled it
+    };
+
+    bool absolute = !pattern.empty() && pattern[0] == '/';
+    std::vector<Match> frontier{ { absolute ? root.get() : current, absolute ? "/" : "" } };
+    std::vector<Match> next;
+
+    auto join = [](const std::string& base, std::string_view name) {
+        if (base.empty()) return std::string(name);
+        if (base.back() == '/') return base + std::string(name);
+        return base + "/" + std::string(name);
+    };
+    auto enter = [this](const VFSNode* node) {
+        Volume* vol = node->getVolume();
+        if (vol && !vol->loaded)
+            loadVolume(*vol);
+    };
+
+    size_t start = 0;
+    while (start <= pattern.size() && !frontier.empty()) {
+        size_t slash = pattern.find('/', start);
+        if (slash == std::string_view::npos) slash = pattern.size();
+        std::string_view part = pattern.substr(start, slash - start);
+        bool last = slash == pattern.size();
+        start = slash + 1;
+
+        if (part.empty() || part == ".")
+            continue;
+
+        next.clear();
+        if (part == "..") {
+            for (const Match& m : frontier)
+                next.push_back({ m.node->getParent() ? m.node->getParent() : m.node, join(m.path, "..") });
+        }
+        else if (!hasGlobChars(part)) {
+            //literal component: one index lookup per candidate
+            for (const Match& m : frontier) {
+                const VFSNode* child = m.node->isDirectory() ? m.node->findChildConst(part) : nullptr;
+                if (!child) continue;
+                enter(child);
+                next.push_back({ child, join(m.path, part) });
+            }
+        }
+        else if (part == "**") {
+            //zero or more directories; at the end, everything below
+            std::vector<Match> stack(frontier.rbegin(), frontier.rend());
+            while (!stack.empty()) {
+                Match m = std::move(stack.back());
+                stack.pop_back();
+                if (!last)
+                    next.push_back(m);
+                if (!m.node->isDirectory() || !checkPermission(m.node, 'r'))
+                    continue;
+
+                //volumes that are not loaded yet look empty here; only a
+                //pattern that names the mount point reads one in
+                size_t mark = stack.size();
+                for (const auto& child : m.node->getChildrenConst()) {
+                    if (child->getName()[0] == '.')
+                        continue;
+                    if (last)
+                        next.push_back({ child.get(), join(m.path, child->getName()) });
+                    stack.push_back({ child.get(), join(m.path, child->getName()) });
+                }
+                std::reverse(stack.begin() + mark, stack.end());
+            }
+        }
+        else {
+            //one pass over each candidate directory
+            bool showHidden = part[0] == '.';
+            for (const Match& m : frontier) {
+                if (!m.node->isDirectory() || !checkPermission(m.node, 'r'))
+                    continue;
+                for (const auto& child : m.node->getChildrenConst()) {
+                    const std::string& name = child->getName();
+                    if ((name[0] == '.' && !showHidden) || !globMatch(part, name))
+                        continue;
+                    enter(child.get());
+                    next.push_back({ child.get(), join(m.path, name) });
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+
+    //a trailing slash only matches directories
+    bool dirsOnly = !pattern.empty() && pattern.back() == '/';
+
+    size_t before = out.size();
+    for (Match& m : frontier) {
+        if (dirsOnly && !m.node->isDirectory())
+            continue;
+        out.push_back(std::move(m.path));
+    }
+    std::sort(out.begin() + before, out.end());
+    out.erase(std::unique(out.begin() + before, out.end()), out.end());
+    return out.size() == before ? VfsStatus::NotFound : VfsStatus::Ok;
+}
+
+//batches
+
+//the ops of one batch that share a parent directory
+struct BatchGroup {
+    std::string_view parentPath;
+    std::vector<size_t> ops;
+    VFSNode* parent = nullptr;
+    VfsStatus status = VfsStatus::Ok;   //of resolving the parent
+    bool changed = false;
+    std::vector<size_t> deferred;       //left for the serial pass after a parallel run
+};
+
+namespace {
+
+//below this, starting threads costs more than the batch
+const size_t PARALLEL_BATCH = 4096;
+
+std::string_view baseName(std::string_view path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+}
+
+void VirtualFileSystem::runBatchGroup(const std::vector<TxOp>& ops, BatchGroup& group,
+    std::vector<VfsStatus>& results, bool parallel) {
+    VFSNode* parent = group.parent;
+    bool writable = checkPermission(parent, 'w');
+    std::vector<const VFSNode*> doomed;
+    std::unordered_set<const VFSNode*> doomedSet;
+
+    //removals are swept together, but before anything else in the group
+    //that could see the names they free
+    auto sweep = [&] {
+        parent->removeChildren(doomed);
+        doomed.clear();
+        doomedSet.clear();
+    };
+
+    for (size_t i : group.ops) {
+        const TxOp& op = ops[i];
+        if (op.kind != TxOp::Kind::Rm && !doomed.empty())
+            sweep();
+
+        std::string_view name = baseName(op.path);
+        VFSNode* node = parent->findChild(name);
+        VfsStatus st = VfsStatus::Ok;
+
+        switch (op.kind) {
+        case TxOp::Kind::Mkdir:
+            if (node) {
+                st = VfsStatus::AlreadyExists;
+            }
+            else if (!writable) {
+                st = VfsStatus::PermissionDenied;
+            }
+            else {
+                node = parent->addDirectory(std::string(name));
+                node->setPermissions("rwx");
+                group.changed = true;
+                notify(VfsEvent::Kind::Create, node);
+            }
+            break;
+
+        case TxOp::Kind::Touch:
+            if (node) break;
+            if (!writable) {
+                st = VfsStatus::PermissionDenied;
+            }
+            else {
+                node = parent->addFile(std::string(name));
+                node->setPermissions("rw-");
+                group.changed = true;
+                notify(VfsEvent::Kind::Create, node);
+            }
+            break;
+
+        case TxOp::Kind::Chmod:
+            if (!node) {
+                st = VfsStatus::NotFound;
+            }
+            else if (op.arg.size() != 3) {
+                st = VfsStatus::InvalidArgument;
+            }
+            else if (Volume* vol = node->getVolume()) {
+                //a mount point may need loading and marks its own volume,
+                //both of which touch shared state
+                if (parallel) {
+                    group.deferred.push_back(i);
+                    continue;
+                }
+                if (!vol->loaded)
+                    loadVolume(*vol);
+                node->setPermissions(op.arg);
+                markDirty(node);
+                notify(VfsEvent::Kind::Chmod, node);
+            }
+            else {
+                node->setPermissions(op.arg);
+                group.changed = true;
+                notify(VfsEvent::Kind::Chmod, node);
+            }
+            break;
+
+        case TxOp::Kind::Rm:
+            if (!node || doomedSet.count(node)) {
+                st = VfsStatus::NotFound;
+            }
+            else if (!writable) {
+                st = VfsStatus::PermissionDenied;
+            }
+            else if (hasMountInside(node)) {
+                st = VfsStatus::Busy;
+            }
+            else if (node->isDirectory() && !op.recursive && !node->getChildrenConst().empty()) {
+                st = VfsStatus::NotEmpty;
+            }
+            else {
+                if (isInside(current, node))
+                    current = parent;
+                notify(VfsEvent::Kind::Remove, node);
+                doomed.push_back(node);
+                doomedSet.insert(node);
+                group.changed = true;
+            }
+            break;
+
+        case TxOp::Kind::Write:
+        case TxOp::Kind::Copy:
+        case TxOp::Kind::Move:
+            st = VfsStatus::InvalidArgument; //never grouped
+            break;
+        }
+        results[i] = st;
+    }
+
+    if (!doomed.empty())
+        sweep();
+}
+
+VfsStatus VirtualFileSystem::applyBatch(const std::vector<TxOp>& ops, std::vector<VfsStatus>& results) {
+    results.assign(ops.size(), VfsStatus::Ok);
+
+    //group by parent directory, in the order the directories first appear.
+    //writes, copies, moves and paths without a usable last component go
+    //through the single-path API as groups of their own
+    std::vector<BatchGroup> groups;
+    std::unordered_map<std::string_view, size_t> groupOf;
+    std::vector<bool> single;
+    bool touchOrChmod = true;
+
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const TxOp& op = ops[i];
+        std::string_view path = op.path;
+        std::string_view name = baseName(path);
+        touchOrChmod = touchOrChmod && (op.kind == TxOp::Kind::Touch || op.kind == TxOp::Kind::Chmod);
+
+        bool grouped = op.kind != TxOp::Kind::Write && op.kind != TxOp::Kind::Copy && op.kind != TxOp::Kind::Move;
+        if (!grouped || name.empty() || name == "." || name == "..") {
+            groups.emplace_back();
+            groups.back().ops.push_back(i);
+            single.push_back(true);
+            continue;
+        }
+
+        size_t slash = path.find_last_of('/');
+        std::string_view parentPath = slash == std::string_view::npos ? "" : path.substr(0, slash == 0 ? 1 : slash);
+        auto found = groupOf.find(parentPath);
+        if (found == groupOf.end()) {
+            found = groupOf.emplace(parentPath, groups.size()).first;
+            groups.emplace_back();
+            groups.back().parentPath = parentPath;
+            single.push_back(false);
+        }
+        groups[found->second].ops.push_back(i);
+    }
+
+    auto resolveGroup = [this](BatchGroup& g) {
+        g.parent = g.parentPath.empty() ? current : resolvePath(g.parentPath);
+        if (!g.parent)
+            g.status = VfsStatus::NotFound;
+        else if (!g.parent->isDirectory())
+            g.status = VfsStatus::NotADirectory;
+    };
+    auto failGroup = [&](const BatchGroup& g) {
+        for (size_t i : g.ops)
+            results[i] = g.status;
+    };
+
+    //touch and chmod never create directories or free nodes, so once every
+    //parent is known the directories are independent of each other
+    if (touchOrChmod && ops.size() >= PARALLEL_BATCH && groups.size() > 1) {
+        //the same directory spelled two ways must still be a single group
+        std::unordered_map<const VFSNode*, size_t> byNode;
+        std::vector<BatchGroup*> work;
+        std::vector<BatchGroup*> merged;
+        for (size_t g = 0; g < groups.size(); ++g) {
+            BatchGroup& group = groups[g];
+            if (single[g]) {
+                results[group.ops[0]] = VfsStatus::InvalidArgument;
+                continue;
+            }
+            resolveGroup(group);
+            if (group.status != VfsStatus::Ok) {
+                failGroup(group);
+                continue;
+            }
+
+            auto found = byNode.emplace(group.parent, g);
+            if (found.second) {
+                work.push_back(&group);
+            }
+            else {
+                BatchGroup& first = groups[found.first->second];
+                first.ops.insert(first.ops.end(), group.ops.begin(), group.ops.end());
+                merged.push_back(&first);
+            }
+        }
+        //a merged group still has to run its ops in the order they were given
+        for (BatchGroup* group : merged)
+            std::sort(group->ops.begin(), group->ops.end());
+
+        unsigned threads = std::min<size_t>(transferThreads(), work.size());
+        std::atomic<size_t> nextGroup{ 0 };
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; ++t) {
+            pool.emplace_back([&] {
+                for (size_t g; (g = nextGroup.fetch_add(1)) < work.size();)
+                    runBatchGroup(ops, *work[g], results, true);
+            });
+        }
+        for (auto& th : pool)
+            th.join();
+
+        for (BatchGroup* group : work) {
+            if (group->changed)
+                markDirty(group->parent);
+            if (!group->deferred.empty()) {
+                group->ops.swap(group->deferred);
+                runBatchGroup(ops, *group, results, false);
+            }
+        }
+    }
+    else {
+        for (size_t g = 0; g < groups.size(); ++g) {
+            BatchGroup& group = groups[g];
+            if (single[g]) {
+                const TxOp& op = ops[group.ops[0]];
+                size_t failed = 0;
+                results[group.ops[0]] = applyOps({ op }, failed);
+                continue;
+            }
+
+            resolveGroup(group);
+            if (group.status != VfsStatus::Ok) {
+                failGroup(group);
+                continue;
+            }
+            runBatchGroup(ops, group, results, false);
+            if (group.changed)
+                markDirty(group.parent);
+        }
+    }
+
+    for (VfsStatus st : results) {
+        if (st != VfsStatus::Ok)
+            return st;
+    }
+    return VfsStatus::Ok;
+}
+
+bool VirtualFileSystem::cmdBatch(const char* cmd, const std::vector<TxOp>& ops) {
+    if (ops.empty()) {
+        *console << cmd << ": missing operand\n";
+        return false;
+    }
+
+    std::vector<VfsStatus> results;
+    VfsStatus st = applyBatch(ops, results);
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (results[i] != VfsStatus::Ok)
+            *console << cmd << ": " << ops[i].path << ": " << statusMessage(results[i]) << "\n";
+    }
+    return st == VfsStatus::Ok;
+}
+
+std::string VirtualFileSystem::copyTarget(const std::string& src, const std::string& dstDir) {
+    //"dir/" is copied as dir
+    std::string_view trimmed = src;
+    while (trimmed.size() > 1 && trimmed.back() == '/')
+        trimmed.remove_suffix(1);
+
+    std::string target = dstDir;
+    if (target.empty() || target.back() != '/')
+        target += "/";
+    return target + std::string(baseName(trimmed));
+}
+
+bool VirtualFileSystem::cmdCpInto(const std::vector<std::string>& sources, const std::string& dstDir) {
+    const VFSNode* dir = resolvePathConst(dstDir);
+    if (!dir || !dir->isDirectory())
+        return report(*console, "cp", dir ? VfsStatus::NotADirectory : VfsStatus::NotFound);
+
+    bool ok = true;
+    for (const std::string& src : sources) {
+        VfsStatus st = copy(src, copyTarget(src, dstDir));
+        if (st != VfsStatus::Ok) {
+            *console << "cp: " << src << ": " << statusMessage(st) << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// tree printnter
+
+void VirtualFileSystem::cmdTree() const {
+    cmdTree(*console);
+}
+
+void VirtualFileSystem::cmdTree(std::ostream& out) const {
+    struct Helper {
+        static void print(const VFSNode* node, const std::string& prefix, bool last, const VFSNode* root,
+            std::ostream& out) {
+            out << prefix;
+
+            if (node != root)
+                out << (last ? "`-- " : "|-- ");
+
+            const Volume* vol = node->getVolume();
+            if (node == root)
+                out << "/\n";
+            else if (vol && !vol->loaded)
+                out << node->getName() << " [" << vol->snapshot << ", not loaded]\n";
+            else
+                out << node->getName() << "\n";
+
+            const auto& kids = node->getChildrenConst();
+            for (size_t i = 0; i < kids.size(); ++i) {
+                bool childLast = (i == kids.size() - 1);
+                std::string newPrefix = prefix;
+                if (node != root)
+                    newPrefix += (last ? "    " : "|   ");
+
+                print(kids[i].get(), newPrefix, childLast, root, out);
+            }
+        }
+    };
+
+    Helper::print(root.get(), "", true, root.get(), out);
+}
+
+//save/load
+
+void VirtualFileSystem::saveNodeRecursive(const VFSNode* node, const VFSNode* base,
+    const std::string& path, std::ostream& out) const {
+    std::string fullPath = path;
+
+    if (node != base) {
+        if (fullPath != "/")
+            fullPath += "/";
+        fullPath += node->getName();
+
+        //another volume starts here; it is saved on its own
+        if (node->getVolume()) {
+            out << "MOUNT " << fullPath << " " << node->getVolume()->snapshot << "\n";
+            return;
+        }
+    }
+
+    out << "NODE " << (node->isDirectory() ? "DIR " : "FILE ")
+        << node->getPermissions() << " " << fullPath << "\n";
+
+    if (node->isFile()) {
+        out << "CONTENT_BEGIN\n";
+        store.readChunks(node, [&](const char* data, size_t len) {
+            out.write(data, static_cast<std::streamsize>(len));
+        });
+        out << "CONTENT_END\n";
+    }
+
+    for (const auto& child : node->getChildrenConst()) {
+        saveNodeRecursive(child.get(), base, fullPath, out);
+    }
+}
+
+bool VirtualFileSystem::saveVolume(Volume& vol) const {
+    std::ofstream out(vol.snapshot);
+    if (!out)
+        return false;
+    saveNodeRecursive(vol.mountPoint, vol.mountPoint, "/", out);
+    out.close();
+
+    if (!out)
+        return false;
+    vol.dirty = false;
+    return true;
+}
+
+bool VirtualFileSystem::saveSnapshots() const {
+    //volumes nobody changed are left alone
+    bool ok = true;
+    for (const auto& vol : volumes) {
+        if (vol->loaded && vol->dirty && !saveVolume(*vol))
+            ok = false;
     }
-    saveNodeRecursive(root.get(), "/", out);
+    if (!ok)
+        return false;
+
+    //the snapshots now contain every committed transaction
+    journal.reset();
+    unjournaled = false;
+    return true;
+}
+
+void VirtualFileSystem::save() const {
+    if (!saveSnapshots())
+        *console << "Could not save filesystem.\n";
 }
 
 void VirtualFileSystem::buildPathDirectory(const std::string& dirPath) {
-    ensureDirectory(dirPath);
+    ensureDirectory(root.get(), dirPath);
 }
 
-VFSNode* VirtualFileSystem::ensureDirectory(const std::string& dirPath) {
+VFSNode* VirtualFileSystem::ensureDirectory(VFSNode* base, const std::string& dirPath) const {
     if (dirPath.empty() || dirPath == "/")
-        return root.get();
+        return base;
 
-    VFSNode* node = root.get();
+    VFSNode* node = base;
     auto parts = splitPath(dirPath);
 
     for (const auto& part : parts) {
@@ -576,12 +1943,12 @@ VFSNode* VirtualFileSystem::ensureDirectory(const std::string& dirPath) {
     return node;
 }
 
-VFSNode* VirtualFileSystem::createFileAtPath(const std::string& filePath) {
+VFSNode* VirtualFileSystem::createFileAtPath(VFSNode* base, const std::string& filePath) const {
     size_t slash = filePath.find_last_of('/');
     std::string parentPath = (slash == std::string::npos) ? "/" : filePath.substr(0, slash);
     std::string filename = (slash == std::string::npos) ? filePath : filePath.substr(slash + 1);
 
-    VFSNode* parent = ensureDirectory(parentPath);
+    VFSNode* parent = ensureDirectory(base, parentPath);
     VFSNode* file = parent->findChild(filename);
 
     if (!file) {
@@ -592,30 +1959,7 @@ VFSNode* VirtualFileSystem::createFileAtPath(const std::string& filePath) {
     return file;
 }
 
-void VirtualFileSystem::load() {
-    std::ifstream in(saveFileName);
-    if (!in) {
-        VFSNode* home = root->addDirectory("home");
-        home->setPermissions("rwx");
-
-        VFSNode* docs = home->addDirectory("docs");
-        docs->setPermissions("rwx");
-
-        VFSNode* readme = docs->addFile("readme.txt");
-        readme->setPermissions("rw-");
-        readme->getContent() =
-            "Welcome to the Virtual File System Shell.\n"
-            "Use commands like ls, cd, mkdir, touch, cat, write, rm, cp, mv.\n";
-
-        current = root.get();
-        return;
-    }
-
-    //reset/ rebuild tree
-    root = std::make_unique<VFSNode>("/", VFSNode::Type::Directory, nullptr);
-    root->setPermissions("rwx");
-    current = root.get();
-
+void VirtualFileSystem::loadTree(std::istream& in, VFSNode* base) const {
     std::string line;
     bool readingContent = false;
     VFSNode* lastFile = nullptr;
@@ -624,7 +1968,8 @@ void VirtualFileSystem::load() {
     while (std::getline(in, line)) {
         if (line.rfind("NODE ", 0) == 0) {
             if (readingContent && lastFile) {
-                lastFile->getContent() = buffer.str();
+                lastFile->getContent().assign(buffer.str());
+                store.replaced(lastFile);
                 buffer.str("");
                 buffer.clear();
                 readingContent = false;
@@ -635,22 +1980,35 @@ void VirtualFileSystem::load() {
             ss >> token >> type >> perms >> path;
 
             if (type == "DIR") {
-                VFSNode* d = ensureDirectory(path);
+                VFSNode* d = ensureDirectory(base, path);
                 d->setPermissions(perms);
             }
             else if (type == "FILE") {
-                lastFile = createFileAtPath(path);
+                lastFile = createFileAtPath(base, path);
                 lastFile->setPermissions(perms);
             }
         }
+        else if (line.rfind("MOUNT ", 0) == 0 && !readingContent) {
+            std::stringstream ss(line);
+            std::string token, path, snapshot;
+            ss >> token >> path;
+            std::getline(ss >> std::ws, snapshot);
+
+            //registered only; the volume is read when first reached
+            VFSNode* point = ensureDirectory(base, path);
+            if (!snapshot.empty() && point != base && !point->getVolume())
+                addVolume(snapshot, point, false);
+        }
         else if (line == "CONTENT_BEGIN") {
             readingContent = true;
             buffer.str("");
             buffer.clear();
         }
         else if (line == "CONTENT_END") {
-            if (lastFile)
-                lastFile->getContent() = buffer.str();
+            if (lastFile) {
+                lastFile->getContent().assign(buffer.str());
+                store.replaced(lastFile);
+            }
 
             readingContent = false;
             lastFile = nullptr;
@@ -662,8 +2020,556 @@ void VirtualFileSystem::load() {
         }
     }
 
-    if (readingContent && lastFile)
-        lastFile->getContent() = buffer.str();
+    if (readingContent && lastFile) {
+        lastFile->getContent().assign(buffer.str());
+        store.replaced(lastFile);
+    }
+}
+
+void VirtualFileSystem::load() {
+    std::ifstream in(saveFileName);
+    if (!in) {
+        VFSNode* home = root->addDirectory("home");
+        home->setPermissions("rwx");
+
+        VFSNode* docs = home->addDirectory("docs");
+        docs->setPermissions("rwx");
+
+        VFSNode* readme = docs->addFile("readme.txt");
+        readme->setPermissions("rw-");
+        readme->getContent().assign(
+            "Welcome to the Virtual File System Shell.\n"
+            "Use commands like ls, cd, mkdir, touch, cat, write, rm, cp, mv.\n");
+
+        volumes[0]->dirty = true;
+        current = root.get();
+        replayJournal();
+        return;
+    }
+
+    //reset/ rebuild tree
+    root = std::make_unique<VFSNode>("/", VFSNode::Type::Directory, nullptr);
+    root->setPermissions("rwx");
+    current = root.get();
+    volumes.clear();
+    addVolume(saveFileName, root.get(), true);
+
+    loadTree(in, root.get());
+
+    current = root.get();
+    replayJournal();
+}
+
+//volumes
+
+Volume* VirtualFileSystem::addVolume(const std::string& snapshot, VFSNode* mountPoint, bool loaded) const {
+    volumes.push_back(std::make_unique<Volume>(Volume{ snapshot, mountPoint, loaded, false }));
+    mountPoint->setVolume(volumes.back().get());
+    return volumes.back().get();
+}
+
+void VirtualFileSystem::loadVolume(Volume& vol) const {
+    //reading a volume in does not change what the tree holds, so const
+    //lookups are allowed to trigger it
+    vol.loaded = true;
+    std::ifstream in(vol.snapshot);
+    if (in)
+        loadTree(in, vol.mountPoint);
+}
+
+void VirtualFileSystem::loadVolumesUnder(const VFSNode* node) const {
+    //indexed: loading a volume can register the volumes nested in it
+    for (size_t i = 1; i < volumes.size(); ++i) {
+        Volume& vol = *volumes[i];
+        if (!vol.loaded && isInside(vol.mountPoint, node))
+            loadVolume(vol);
+    }
+}
+
+bool VirtualFileSystem::hasMountInside(const VFSNode* node) const {
+    for (size_t i = 1; i < volumes.size(); ++i) {
+        if (isInside(volumes[i]->mountPoint, node))
+            return true;
+    }
+    return false;
+}
+
+void VirtualFileSystem::markDirty(const VFSNode* node) {
+    if (!journaling)
+        unjournaled = true;
+    for (; node; node = node->getParent()) {
+        if (Volume* vol = node->getVolume()) {
+            vol->dirty = true;
+            return;
+        }
+    }
+}
+
+VfsStatus VirtualFileSystem::mount(const std::string& snapshot, std::string_view path) {
+    if (snapshot.empty()) return VfsStatus::InvalidArgument;
+
+    VFSNode* point = resolvePath(path);
+    if (!point) return VfsStatus::NotFound;
+    if (!point->isDirectory()) return VfsStatus::NotADirectory;
+    if (point->getVolume()) return VfsStatus::Busy;
+    if (!point->getChildrenConst().empty()) return VfsStatus::NotEmpty;
+    if (!checkPermission(point, 'w')) return VfsStatus::PermissionDenied;
+
+    //two mounts of one file would overwrite each other
+    for (const auto& vol : volumes) {
+        if (vol->snapshot == snapshot)
+            return VfsStatus::Busy;
+    }
+
+    std::ifstream probe(snapshot);
+    bool exists = static_cast<bool>(probe);
+    Volume* vol = addVolume(snapshot, point, !exists);
+    vol->dirty = !exists;
+    markDirty(point->getParent());
+    notify(VfsEvent::Kind::Create, point);
+    return VfsStatus::Ok;
+}
+
+VfsStatus VirtualFileSystem::unmount(std::string_view path) {
+    //look the mount point up without reading the volume in
+    VFSNode* parent = nullptr;
+    std::string_view name;
+    VfsStatus st = resolveParent(path, parent, name);
+    if (st != VfsStatus::Ok) return st;
+
+    VFSNode* point = parent->findChild(name);
+    if (!point) return VfsStatus::NotFound;
+
+    Volume* vol = point->getVolume();
+    if (!vol) return VfsStatus::InvalidArgument;
+    if (isInside(current, point)) return VfsStatus::Busy;
+    for (size_t i = 1; i < volumes.size(); ++i) {
+        if (volumes[i].get() != vol && isInside(volumes[i]->mountPoint, point))
+            return VfsStatus::Busy;
+    }
+
+    if (vol->loaded && vol->dirty && !saveVolume(*vol))
+        return VfsStatus::IoError;
+
+    //the directory stays, but everything that was in it goes away
+    notify(VfsEvent::Kind::Remove, point);
+    point->releaseChildren();
+    point->setVolume(nullptr);
+    volumes.erase(std::find_if(volumes.begin(), volumes.end(),
+        [vol](const std::unique_ptr<Volume>& v) { return v.get() == vol; }));
+    markDirty(parent);
+    return VfsStatus::Ok;
+}
+
+bool VirtualFileSystem::cmdMount(const std::string& snapshot, const std::string& path) {
+    if (snapshot.empty() || path.empty()) {
+        *console << "mount: usage: mount <snapshot> <dir>\n";
+        return false;
+    }
+
+    VfsStatus st = mount(snapshot, path);
+    if (st == VfsStatus::NotEmpty) {
+        *console << "mount: mount point must be an empty directory\n";
+        return false;
+    }
+    return report(*console, "mount", st);
+}
+
+bool VirtualFileSystem::cmdUnmount(const std::string& path) {
+    if (path.empty()) {
+        *console << "unmount: missing operand\n";
+        return false;
+    }
+    return report(*console, "unmount", unmount(path));
+}
+
+void VirtualFileSystem::cmdMounts() const {
+    if (volumes.size() == 1) {
+        *console << "No volumes mounted.\n";
+        return;
+    }
+
+    for (size_t i = 1; i < volumes.size(); ++i) {
+        const Volume& vol = *volumes[i];
+        *console << vol.snapshot << " on " << pathOf(vol.mountPoint)
+            << (vol.loaded ? " (loaded" : " (not loaded")
+            << (vol.dirty ? ", modified)\n" : ")\n");
+    }
+}
+
+//transactions
+
+namespace {
+
+void putField(std::string& out, const std::string& field) {
+    uint32_t len = static_cast<uint32_t>(field.size());
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>((len >> (8 * i)) & 0xff));
+    out += field;
+}
+
+bool getField(const std::string& in, size_t& pos, std::string& field) {
+    if (pos + 4 > in.size()) return false;
+    uint32_t len = 0;
+    for (int i = 0; i < 4; ++i)
+        len |= uint32_t(static_cast<unsigned char>(in[pos + i])) << (8 * i);
+    pos += 4;
+    if (pos + len > in.size()) return false;
+    field.assign(in, pos, len);
+    pos += len;
+    return true;
+}
+
+//record layout per op: kind byte, recursive byte, path field, arg field
+std::string encodeOps(const std::vector<TxOp>& ops) {
+    std::string out;
+    for (const auto& op : ops) {
+        out.push_back(static_cast<char>(op.kind));
+        out.push_back(op.recursive ? 1 : 0);
+        putField(out, op.path);
+        putField(out, op.arg);
+    }
+    return out;
+}
+
+bool decodeOps(const std::string& in, std::vector<TxOp>& ops) {
+    size_t pos = 0;
+    while (pos < in.size()) {
+        if (pos + 2 > in.size()) return false;
+        TxOp op;
+        op.kind = static_cast<TxOp::Kind>(in[pos]);
+        op.recursive = in[pos + 1] != 0;
+        pos += 2;
+        if (!getField(in, pos, op.path) || !getField(in, pos, op.arg))
+            return false;
+        ops.push_back(std::move(op));
+    }
+    return true;
+}
+
+}
+
+VfsStatus VirtualFileSystem::applyOps(const std::vector<TxOp>& ops, size_t& failedOp) {
+    //every applied step leaves an undo action; a failure runs them backwards
+    std::vector<std::function<void()>> undo;
+    std::vector<VfsEvent> pending;
+    deferredEvents = &pending;
+
+    auto undoCreate = [&](const std::string& path) {
+        VFSNode* node = resolvePath(path);
+        VFSNode* parent = node->getParent();
+        std::string name = node->getName();
+        undo.push_back([parent, name] { parent->removeChild(name); });
+    };
+
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const TxOp& op = ops[i];
+        VfsStatus st = VfsStatus::Ok;
+
+        switch (op.kind) {
+        case TxOp::Kind::Mkdir:
+            st = makeDirectory(op.path);
+            if (st == VfsStatus::Ok) undoCreate(op.path);
+            break;
+
+        case TxOp::Kind::Touch: {
+            bool existed = resolvePath(op.path) != nullptr;
+            st = createFile(op.path);
+            if (st == VfsStatus::Ok && !existed) undoCreate(op.path);
+            break;
+        }
+
+        case TxOp::Kind::Write: {
+            VFSNode* node = resolvePath(op.path);
+            if (!node) {
+                st = createFile(op.path);
+                if (st != VfsStatus::Ok) break;
+                undoCreate(op.path);
+                node = resolvePath(op.path);
+            }
+            if (!node->isFile()) {
+                st = VfsStatus::NotAFile;
+                break;
+            }
+            if (!checkPermission(node, 'w')) {
+                st = VfsStatus::PermissionDenied;
+                break;
+            }
+
+            store.touch(node);
+            auto old = std::make_shared<Rope>(std::move(node->getContent()));
+            node->getContent().assign(op.arg);
+            store.replaced(node);
+            markDirty(node);
+            notify(VfsEvent::Kind::Write, node);
+            undo.push_back([this, node, old] {
+                node->getContent() = std::move(*old);
+                store.replaced(node);
+            });
+            break;
+        }
+
+        case TxOp::Kind::Chmod: {
+            VFSNode* node = resolvePath(op.path);
+            std::string oldPerms = node ? node->getPermissions() : "";
+            st = changeMode(op.arg, op.path);
+            if (st == VfsStatus::Ok) undo.push_back([node, oldPerms] { node->setPermissions(oldPerms); });
+            break;
+        }
+
+        case TxOp::Kind::Rm: {
+            //detach rather than destroy so the subtree can be put back
+            VFSNode* target = nullptr;
+            st = findRemovable(op.path, op.recursive, target);
+            if (st != VfsStatus::Ok) break;
+
+            VFSNode* parent = target->getParent();
+            VFSNode* oldCurrent = current;
+            if (isInside(current, target))
+                current = parent;
+            markDirty(parent);
+            notify(VfsEvent::Kind::Remove, target);
+
+            auto held = std::make_shared<std::unique_ptr<VFSNode>>(parent->detachChild(target->getName()));
+            undo.push_back([this, parent, held, oldCurrent] {
+                parent->adoptChild(std::move(*held));
+                current = oldCurrent;
+            });
+            break;
+        }
+
+        case TxOp::Kind::Copy:
+            //copy never replaces anything, so undoing it is removing the copy
+            st = copy(op.path, op.arg);
+            if (st == VfsStatus::Ok) undoCreate(op.arg);
+            break;
+
+        case TxOp::Kind::Move: {
+            VFSNode* node = resolvePath(op.path);
+            VFSNode* oldParent = node ? node->getParent() : nullptr;
+            std::string oldName = node ? node->getName() : "";
+            st = move(op.path, op.arg);
+            if (st == VfsStatus::Ok) {
+                undo.push_back([node, oldParent, oldName] {
+                    std::unique_ptr<VFSNode> back = node->getParent()->detachChild(node->getName());
+                    back->setName(oldName);
+                    oldParent->adoptChild(std::move(back));
+                });
+            }
+            break;
+        }
+        }
+
+        if (st != VfsStatus::Ok) {
+            for (auto it = undo.rbegin(); it != undo.rend(); ++it)
+                (*it)();
+            deferredEvents = nullptr;
+            failedOp = i;
+            return st;
+        }
+    }
+
+    deferredEvents = nullptr;
+    for (const auto& ev : pending)
+        events.publish(ev.kind, ev.path, ev.target);
+    return VfsStatus::Ok;
+}
+
+VfsStatus VirtualFileSystem::applyTransaction(const std::vector<TxOp>& ops, uint64_t& ticket, size_t& failedOp) {
+    //the record would not replay over a snapshot missing what it builds on
+    if (unjournaled && !saveSnapshots()) {
+        failedOp = 0;
+        return VfsStatus::IoError;
+    }
+
+    journaling = true;
+    VfsStatus st = applyOps(ops, failedOp);
+    journaling = false;
+    if (st != VfsStatus::Ok)
+        return st;
+    ticket = journal.enqueue(encodeOps(ops));
+    return VfsStatus::Ok;
+}
+
+VfsStatus VirtualFileSystem::waitDurable(uint64_t ticket) {
+    return journal.waitDurable(ticket) ? VfsStatus::Ok : VfsStatus::IoError;
+}
+
+VfsStatus VirtualFileSystem::commitTransaction(const std::vector<TxOp>& ops, size_t& failedOp) {
+    uint64_t ticket = 0;
+    VfsStatus st = applyTransaction(ops, ticket, failedOp);
+    if (st != VfsStatus::Ok)
+        return st;
 
+    failedOp = ops.size();
+    return waitDurable(ticket);
+}
+
+void VirtualFileSystem::replayJournal() {
+    //commits save first whenever the tree changed outside a transaction, so
+    //a record that does not fit means the snapshot was replaced or edited.
+    //everything after that record builds on it, so replay stops there
+    size_t replayed = 0;
+    bool stopped = false;
+    journaling = true;
+    uint64_t cut = journal.replay([&](const std::string& record) {
+        if (stopped)
+            return;
+
+        std::vector<TxOp> ops;
+        size_t failedOp = 0;
+        VfsStatus st = decodeOps(record, ops) ? applyOps(ops, failedOp) : VfsStatus::InvalidArgument;
+        if (st != VfsStatus::Ok) {
+            *console << "journal: transaction " << replayed + 1 << " does not apply to "
+                << saveFileName << " (" << statusMessage(st) << "); "
+                << replayed << " replayed, the rest skipped\n";
+            stopped = true;
+            return;
+        }
+        ++replayed;
+    });
+    journaling = false;
+    //the tree now differs from snapshot plus journal: the next commit saves
+    //first, so it is not appended behind the records that were skipped
+    unjournaled = stopped;
+    if (cut > 0)
+        *console << "journal: dropped " << cut << " damaged bytes at the end of " << saveFileName << ".journal\n";
     current = root.get();
 }
+
+//memory budget / accounting
+
+size_t MemoryUsage::total() const {
+    return headers + names + permissions + content + containers;
+}
+
+void MemoryUsage::add(const MemoryUsage& other) {
+    nodes += other.nodes;
+    headers += other.headers;
+    names += other.names;
+    permissions += other.permissions;
+    content += other.content;
+    spilled += other.spilled;
+    containers += other.containers;
+}
+
+size_t stringHeapBytes(const std::string& s) {
+    static const size_t inlineCapacity = std::string().capacity();
+    return s.capacity() > inlineCapacity ? s.capacity() + 1 : 0;
+}
+
+void VirtualFileSystem::accountSubtree(const VFSNode* node, MemoryUsage& usage) const {
+    node->accountMemory(usage);
+    if (node->isFile())
+        usage.spilled += store.contentSize(node) - node->getContentConst().size();
+
+    for (const auto& child : node->getChildrenConst())
+        accountSubtree(child.get(), usage);
+}
+
+VfsStatus VirtualFileSystem::memoryUsage(std::string_view path, MemoryUsage& out) const {
+    //walk from the node we already have so unloaded volumes stay unloaded
+    const VFSNode* node = path.empty() || path == "/" ? root.get() : resolvePathConst(path);
+    if (!node) return VfsStatus::NotFound;
+
+    out = MemoryUsage();
+    accountSubtree(node, out);
+    return VfsStatus::Ok;
+}
+
+void VirtualFileSystem::cmdBudget(size_t bytes) {
+    store.setBudget(bytes);
+}
+
+void VirtualFileSystem::cmdStats() const {
+    const ContentStore::Stats& st = store.getStats();
+
+    *console << "content budget:    ";
+    if (st.budget == 0)
+        *console << "unlimited\n";
+    else
+        *console << st.budget << " bytes\n";
+
+    *console << "resident bytes:    " << st.residentBytes << "\n";
+    *console << "spilled files:     " << st.spilledFiles << " (" << st.spilledBytes << " bytes)\n";
+    *console << "spill file:        " << st.backingBytes << " bytes (" << st.reusableBytes << " free for reuse)\n";
+    *console << "evictions:         " << st.evictions << "\n";
+    *console << "faults:            " << st.faults << "\n";
+    if (st.faults > 0) {
+        *console << "fault-in avg/max:  " << (st.faultNanosTotal / st.faults / 1000) << " / "
+            << (st.faultNanosMax / 1000) << " us\n";
+    }
+    if (st.spillErrors > 0)
+        *console << "spill errors:      " << st.spillErrors << "\n";
+
+    //records per sync is how well concurrent commits group up
+    Journal::Stats js = journal.getStats();
+    *console << "journal:           " << js.records << " records in " << js.syncs << " syncs";
+    if (js.syncs > 0)
+        *console << " (" << std::fixed << std::setprecision(1) << double(js.records) / js.syncs
+            << std::defaultfloat << " per sync)";
+    *console << "\n";
+
+    MemoryUsage usage;
+    memoryUsage("/", usage);
+    *console << "tree memory:       " << usage.total() << " bytes in " << usage.nodes << " nodes (see mem)\n";
+}
+
+bool VirtualFileSystem::cmdMem(const std::string& path) const {
+    const VFSNode* dir = path.empty() || path == "/" ? root.get() : resolvePathConst(path);
+    if (!dir)
+        return report(*console, "mem", VfsStatus::NotFound);
+
+    MemoryUsage usage;
+    memoryUsage(path, usage);
+    size_t total = usage.total();
+
+    auto row = [&](const char* label, size_t bytes) {
+        *console << "  " << std::left << std::setw(18) << label << std::right << std::setw(12) << bytes;
+        if (total > 0)
+            *console << "  " << std::setw(3) << (bytes * 100 / total) << "%";
+        *console << "\n";
+    };
+
+    *console << "memory under " << pathOf(dir) << " (" << usage.nodes << " nodes):\n";
+    row("node headers", usage.headers);
+    row("names", usage.names);
+    row("permissions", usage.permissions);
+    row("content", usage.content);
+    row("containers", usage.containers);
+    *console << "  " << std::left << std::setw(18) << "total" << std::right << std::setw(12) << total << "\n";
+    if (usage.spilled > 0)
+        *console << "  (" << usage.spilled << " more bytes of content are in the spill file)\n";
+
+    //process-wide structures only make sense for the whole tree
+    if (dir == root.get()) {
+        *console << "bookkeeping:\n";
+        *console << "  " << std::left << std::setw(18) << "content store" << std::right << std::setw(12)
+            << store.indexBytes() << "\n";
+        *console << "  " << std::left << std::setw(18) << "event ring" << std::right << std::setw(12)
+            << events.ringBytes() << "\n";
+        *console << "  " << std::left << std::setw(18) << "volumes" << std::right << std::setw(12)
+            << volumes.capacity() * sizeof(std::unique_ptr<Volume>) + volumes.size() * sizeof(Volume) << "\n";
+    }
+
+    //per-subtree breakdown of the largest children
+    std::vector<std::pair<size_t, const VFSNode*>> sizes;
+    for (const auto& child : dir->getChildrenConst()) {
+        MemoryUsage sub;
+        accountSubtree(child.get(), sub);
+        sizes.emplace_back(sub.total(), child.get());
+    }
+    std::sort(sizes.begin(), sizes.end(),
+        [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    if (!sizes.empty())
+        *console << "largest entries:\n";
+    for (size_t i = 0; i < sizes.size() && i < 10; ++i) {
+        const VFSNode* n = sizes[i].second;
+        *console << "  " << std::setw(12) << sizes[i].first << "  " << n->getName()
+            << (n->isDirectory() ? "/" : "") << "\n";
+    }
+    if (sizes.size() > 10)
+        *console << "  ... " << sizes.size() - 10 << " more\n";
+    return true;
+}
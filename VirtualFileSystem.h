@@ -3,6 +3,58 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <map>
+#include <string_view>
+#include <functional>
+#include <iostream>
+#include "ContentStore.h"
+#include "Journal.h"
+#include "EventStream.h"
+#include "Rope.h"
+
+//result of every library call; front ends turn these into messages
+enum class VfsStatus {
+    Ok,
+    NotFound,
+    NotADirectory,
+    NotAFile,
+    AlreadyExists,
+    PermissionDenied,
+    InvalidArgument,
+    NotEmpty,
+    IsRoot,
+    IoError,
+    Busy
+};
+
+const char* statusMessage(VfsStatus status);
+
+//lines typed after a prompt on out, up to a line holding only ".end"
+std::string readTextBlock(std::istream& in, std::ostream& out);
+
+//bytes held by part of the tree, by where they live. heap figures are the
+//sizes requested from the allocator (string/vector capacity, map nodes)
+struct MemoryUsage {
+    size_t nodes = 0;
+    size_t headers = 0;     //the VFSNode objects themselves
+    size_t names = 0;       //name strings that outgrew the inline buffer
+    size_t permissions = 0;
+    size_t content = 0;     //resident file bodies
+    size_t spilled = 0;     //bodies parked in the spill file (not in memory)
+    size_t containers = 0;  //children vectors and the name index
+
+    size_t total() const;
+    void add(const MemoryUsage& other);
+};
+
+//heap bytes behind a string; short strings live inside the object
+size_t stringHeapBytes(const std::string& s);
+
+//shell wildcards within one path component: * ? [abc] [a-z] [!x]
+bool hasGlobChars(std::string_view s);
+bool globMatch(std::string_view pattern, std::string_view name);
+
+struct Volume;
 
 class VFSNode {
 public:
@@ -16,38 +68,94 @@ private:
     Type type;
     VFSNode* parent;
     std::vector<std::unique_ptr<VFSNode>> children;
-    std::string content;
+    std::map<std::string, VFSNode*, std::less<>> childIndex; //children ordered by name
+    Rope content;
     std::string permissions;
 
+    //set while the content store tracks this node's body
+    friend class ContentStore;
+    ContentStore* store;
+
+    Volume* volume; //set on mount points, and on the root for the main save file
+
 public:
     VFSNode(const std::string& name, Type type, VFSNode* parent);
+    ~VFSNode();
 
     const std::string& getName() const;
+    void setName(const std::string& newName); //only while detached
     Type getType() const;
     VFSNode* getParent() const;
 
     void setPermissions(const std::string& perms);
     const std::string& getPermissions() const;
 
-    std::string& getContent();
-    const std::string& getContentConst() const;
+    Rope& getContent();
+    const Rope& getContentConst() const;
 
     bool isDirectory() const;
     bool isFile() const;
 
+    Volume* getVolume() const;
+    void setVolume(Volume* vol);
+
     std::vector<std::unique_ptr<VFSNode>>& getChildren();
     const std::vector<std::unique_ptr<VFSNode>>& getChildrenConst() const;
 
-    VFSNode* findChild(const std::string& name);
-    const VFSNode* findChildConst(const std::string& name) const;
+    VFSNode* findChild(std::string_view name);
+    const VFSNode* findChildConst(std::string_view name) const;
 
     VFSNode* addDirectory(const std::string& name);
     VFSNode* addFile(const std::string& name);
 
     bool removeChild(const std::string& name);
+    void removeChildren(const std::vector<const VFSNode*>& doomed); //one pass over the children
+    std::unique_ptr<VFSNode> detachChild(const std::string& name);
+
+    //splicing whole subtrees in and out
+    VFSNode* adoptChild(std::unique_ptr<VFSNode> child);
+    std::vector<std::unique_ptr<VFSNode>> releaseChildren();
+
+    //sorted paging: up to `limit` children whose names sort after `cursor`
+    //(empty cursor = first page). returns the cursor for the next page, "" when done
+    std::string listPage(const std::string& cursor, size_t limit,
+        std::vector<const VFSNode*>& out) const;
+
+    //adds this node's own bytes; children are not included
+    void accountMemory(MemoryUsage& usage) const;
 
     //debug helper
-    void listChildren(bool showPermissions) const;
+    void listChildren(bool showPermissions, std::ostream& out = std::cout) const;
+};
+
+//a snapshot file attached at a directory. the main save file is the
+//volume mounted on "/"; the others load the first time a path walk reaches
+//them and are only rewritten when something inside them changed
+struct Volume {
+    std::string snapshot;
+    VFSNode* mountPoint;
+    bool loaded;
+    bool dirty;
+};
+
+//one staged operation of a transaction. paths are absolute
+struct BatchGroup;
+
+struct TxOp {
+    enum class Kind {
+        Mkdir,
+        Touch,
+        Write,
+        Chmod,
+        Rm,
+        Copy,
+        Move
+    };
+
+    Kind kind;
+    std::string path;
+    std::string arg;    //body for Write, permissions for Chmod, destination for Copy/Move
+    bool recursive;     //rm -r
 };
 
 class VirtualFileSystem {
@@ -55,24 +163,68 @@ private:
     std::unique_ptr<VFSNode> root;
     VFSNode* current;
     std::string saveFileName;
+    mutable ContentStore store;
+    mutable Journal journal; //save() is const but truncates it
+    EventStream events;
+    std::vector<VfsEvent>* deferredEvents; //set while a transaction is applying
+    //changes made outside a transaction are in neither the snapshot nor the
+    //journal until the next save, and a journaled transaction may depend on
+    //them. mutable because save() clears it
+    mutable bool unjournaled;
+    bool journaling; //set while the changes being made have a journal record
+    std::ostream* console; //where the shell commands print
+    //[0] is the main save file. mutable because const lookups read volumes
+    //in, which registers the volumes nested in them
+    mutable std::vector<std::unique_ptr<Volume>> volumes;
 
     //internalhelpers
     std::vector<std::string> splitPath(const std::string& path) const;
-    VFSNode* resolvePath(const std::string& path);
-    const VFSNode* resolvePathConst(const std::string& path) const;
+    VFSNode* resolvePath(std::string_view path);
+    const VFSNode* resolvePathConst(std::string_view path) const;
+    //stops with `unloaded` set instead of reading a volume in when loadVolumes is false
+    const VFSNode* walkPath(std::string_view path, bool loadVolumes, bool& unloaded) const;
+    VfsStatus resolveParent(std::string_view path, VFSNode*& parent, std::string_view& name);
 
     bool checkPermission(const VFSNode* node, char needed) const;
 
-    void saveNodeRecursive(const VFSNode* node,
+    void saveNodeRecursive(const VFSNode* node, const VFSNode* base,
         const std::string& currentPath,
         std::ostream& out) const;
+    bool saveVolume(Volume& vol) const;
+    //writes the changed volumes and empties the journal
+    bool saveSnapshots() const;
 
+    //snapshot paths are relative to the volume they belong to. these only
+    //build under `base`, so a const lookup may use them to read a volume in
     void buildPathDirectory(const std::string& dirPath);
-    VFSNode* ensureDirectory(const std::string& dirPath);
-    VFSNode* createFileAtPath(const std::string& filePath);
+    VFSNode* ensureDirectory(VFSNode* base, const std::string& dirPath) const;
+    VFSNode* createFileAtPath(VFSNode* base, const std::string& filePath) const;
+    void loadTree(std::istream& in, VFSNode* base) const;
+
+    //volumes
+    Volume* addVolume(const std::string& snapshot, VFSNode* mountPoint, bool loaded) const;
+    void loadVolume(Volume& vol) const;
+    void loadVolumesUnder(const VFSNode* node) const;
+    bool hasMountInside(const VFSNode* node) const;
+
+    void accountSubtree(const VFSNode* node, MemoryUsage& usage) const;
+    void markDirty(const VFSNode* node);
 
     void copyNodeRecursive(const VFSNode* src, VFSNode* dstParent, const std::string& newName);
 
+    VfsStatus findRemovable(std::string_view path, bool recursive, VFSNode*& target);
+
+    //publish a change; paths are only built when someone is subscribed
+    void notify(VfsEvent::Kind kind, const VFSNode* node);
+    void notify(VfsEvent::Kind kind, const std::string& path, const std::string& target);
+
+    VfsStatus applyOps(const std::vector<TxOp>& ops, size_t& failedOp);
+    void runBatchGroup(const std::vector<TxOp>& ops, BatchGroup& group,
+        std::vector<VfsStatus>& results, bool parallel);
+    //only transactions are journaled; edits made outside one reach disk
+    //with the next save. a record that no longer applies stops the replay
+    void replayJournal();
+
 public:
     VirtualFileSystem(const std::string& saveFile);
 
@@ -80,19 +232,131 @@ public:
     void save() const;
 
     std::string getCurrentPath() const;
+    std::string pathOf(const VFSNode* node) const;
+    std::string absolutePath(const std::string& path) const;
+
+    //library API. nothing here touches iostreams; failures come back as a
+    //status and results are views into node data, valid until the node changes
+    VfsStatus lookup(std::string_view path, const VFSNode*& out) const;
+    //resolving path would read a volume in, which changes the tree
+    bool needsLoad(std::string_view path) const;
+    VfsStatus changeDirectory(std::string_view path);
+    VfsStatus makeDirectory(std::string_view path);
+    VfsStatus createFile(std::string_view path);
+    VfsStatus remove(std::string_view path, bool recursive);
+    //joins the body into one piece, which rebuilds it, so not const
+    VfsStatus readFile(std::string_view path, std::string_view& out);
+    VfsStatus readFile(std::string_view path, std::vector<std::string_view>& out) const; //appends the pieces
+    //hands the body to sink in chunks without paging it in or marking it
+    //used, so several readers can run at once while nothing else changes
+    VfsStatus streamFile(std::string_view path,
+        const std::function<void(const char*, size_t)>& sink) const;
+    VfsStatus writeFile(std::string_view path, std::string_view data);
+    VfsStatus writeFile(std::string_view path, const std::vector<std::string_view>& segments, bool append);
+    //O(log n) edit of an existing file; data must not point into that file
+    VfsStatus insertFile(std::string_view path, size_t offset, std::string_view data);
+    VfsStatus copy(std::string_view srcPath, std::string_view dstPath);
+    //where copying src into the directory dstDir puts it; "dir/" counts as dir
+    static std::string copyTarget(const std::string& src, const std::string& dstDir);
+    VfsStatus move(std::string_view srcPath, std::string_view dstPath);
+    VfsStatus changeMode(std::string_view perms, std::string_view path);
+
+    //attach a snapshot file on an empty directory; a missing file starts an
+    //empty volume. unmount writes the volume back if needed and frees it
+    VfsStatus mount(const std::string& snapshot, std::string_view path);
+    VfsStatus unmount(std::string_view path);
+
+    //memory held by the subtree at path. volumes that are not loaded count as empty
+    VfsStatus memoryUsage(std::string_view path, MemoryUsage& out) const;
+
+    //calls visit(const VFSNode&) for each child, in insertion order
+    template <typename Visitor>
+    VfsStatus visitDirectory(std::string_view path, Visitor&& visit) const;
+    VfsStatus listPage(std::string_view path, const std::string& cursor, size_t limit,
+        std::vector<const VFSNode*>& out, std::string& next) const;
+
+    //transactions: all ops apply or none do, and the batch is made durable
+    //with one journal write. applyTransaction/waitDurable let callers that
+    //serialize access drop their lock before waiting, so commits group up.
+    //on failure failedOp is the index of the op that could not be applied
+    VfsStatus applyTransaction(const std::vector<TxOp>& ops, uint64_t& ticket, size_t& failedOp);
+    VfsStatus waitDurable(uint64_t ticket);
+    VfsStatus commitTransaction(const std::vector<TxOp>& ops, size_t& failedOp);
 
-    //commands
+    //sorted matches for a pattern with wildcards in any component; ** also
+    //matches any number of directories. hidden names need an explicit dot
+    VfsStatus expandGlob(std::string_view pattern, std::vector<std::string>& out) const;
+
+    //many independent ops at once, unlike a transaction each one succeeds or
+    //fails alone. ops are grouped by parent directory so every directory is
+    //resolved and permission-checked once; within a directory they run in
+    //order. large touch/chmod batches spread the directories over threads
+    VfsStatus applyBatch(const std::vector<TxOp>& ops, std::vector<VfsStatus>& results);
+
+    //every mutation above, transactions, import and tar extract publish here
+    EventStream& eventStream();
+
+    //where the shell commands below print; std::cout unless changed.
+    //each thread running commands needs a stream of its own
+    void setConsole(std::ostream& out);
+    std::ostream& getConsole() const;
+
+    //shell commands: print results and errors on top of the API above
+    //without a stream these print to the console, like every other command
     void cmdPwd() const;
+    void cmdPwd(std::ostream& out) const;
     void cmdLs() const;
+    void cmdLs(std::ostream& out) const;
+    bool cmdLsPage(const std::string& cursor, size_t count) const;
     bool cmdCd(const std::string& path);
     bool cmdMkdir(const std::string& path);
     bool cmdTouch(const std::string& path);
     bool cmdRm(const std::string& path, bool recursive);
     bool cmdCat(const std::string& path) const;
-    bool cmdWrite(const std::string& path);
+    bool cmdWrite(const std::string& path, std::istream& in = std::cin);
+    bool cmdAppend(const std::string& path, const std::string& text, std::istream& in = std::cin);
+    bool cmdInsert(const std::string& path, size_t offset, const std::string& text, std::istream& in = std::cin);
     bool cmdCp(const std::string& srcPath, const std::string& dstPath);
     bool cmdMv(const std::string& srcPath, const std::string& dstPath);
     bool cmdChmod(const std::string& perms, const std::string& path);
+    bool cmdBatch(const char* cmd, const std::vector<TxOp>& ops);
+    bool cmdCpInto(const std::vector<std::string>& sources, const std::string& dstDir);
+    bool cmdMount(const std::string& snapshot, const std::string& path);
+    bool cmdUnmount(const std::string& path);
+    void cmdMounts() const;
+
+    //host directory transfer
+    bool cmdImport(const std::string& hostDir, const std::string& vfsDir);
+    bool cmdExport(const std::string& vfsDir, const std::string& hostDir) const;
+
+    //tar archives
+    bool cmdTarCreate(const std::string& archive, const std::string& vfsDir) const;
+    bool cmdTarExtract(const std::string& archive, const std::string& vfsDir);
 
     void cmdTree() const;
+    void cmdTree(std::ostream& out) const;
+
+    //keep every resident body in memory until the matching release, so
+    //views returned by readFile cannot be evicted underneath the caller
+    void holdContent();
+    void releaseContent();
+
+    //memory budget for file bodies
+    void cmdBudget(size_t bytes);
+    void cmdStats() const;
+
+    //memory breakdown for a subtree and its largest children
+    bool cmdMem(const std::string& path) const;
 };
+
+template <typename Visitor>
+VfsStatus VirtualFileSystem::visitDirectory(std::string_view path, Visitor&& visit) const {
+    const VFSNode* dir = resolvePathConst(path);
+    if (!dir) return VfsStatus::NotFound;
+    if (!dir->isDirectory()) return VfsStatus::NotADirectory;
+    if (!checkPermission(dir, 'r')) return VfsStatus::PermissionDenied;
+
+    for (const auto& child : dir->getChildrenConst())
+        visit(*child);
+    return VfsStatus::Ok;
+}
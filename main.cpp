@@ -1,8 +1,70 @@
 #include <iostream>
+#include <string>
+#include <cstdlib>
 #include "VirtualFileSystem.h"
 #include "Shell.h"
+#include "Server.h"
+#include "LoadGenerator.h"
+#include "Replay.h"
+#include "SelfTest.h"
+
+int main(int argc, char* argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "";
+
+    //vsh --server <socket> [workers]
+    if (mode == "--server") {
+        if (argc < 3) {
+            std::cout << "usage: vsh --server <socket> [workers]\n";
+            return 1;
+        }
+        unsigned workers = argc > 3 ? static_cast<unsigned>(std::atoi(argv[3])) : 4;
+
+        VirtualFileSystem vfs("vfs.txt");
+        vfs.load();
+
+        VfsServer server(vfs, argv[2], workers);
+        bool ok = server.run();
+        vfs.save();
+        return ok ? 0 : 1;
+    }
+
+    //vsh --loadgen <socket> [connections] [requests per connection]
+    if (mode == "--loadgen") {
+        if (argc < 3) {
+            std::cout << "usage: vsh --loadgen <socket> [connections] [requests]\n";
+            return 1;
+        }
+        unsigned connections = argc > 3 ? static_cast<unsigned>(std::atoi(argv[3])) : 32;
+        unsigned requests = argc > 4 ? static_cast<unsigned>(std::atoi(argv[4])) : 1000;
+        return runLoadGenerator(argv[2], connections, requests);
+    }
+
+    //vsh --replay <trace> [threads] [--paced] [--snapshot <file>]
+    if (mode == "--replay") {
+        if (argc < 3) {
+            std::cout << "usage: vsh --replay <trace> [threads] [--paced] [--snapshot <file>]\n";
+            return 1;
+        }
+
+        unsigned threads = 1;
+        bool paced = false;
+        std::string snapshot;
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--paced")
+                paced = true;
+            else if (arg == "--snapshot" && i + 1 < argc)
+                snapshot = argv[++i];
+            else
+                threads = static_cast<unsigned>(std::atoi(argv[i]));
+        }
+        return runTraceReplay(argv[2], threads, paced, snapshot);
+    }
+
+    //vsh --selftest
+    if (mode == "--selftest")
+        return runSelfTests();
 
-int main() {
     std::cout << "=====================================\n";
     std::cout << "  Virtual File System Shell (vsh)\n";
     std::cout << "  Simulated mini Linux terminal\n";